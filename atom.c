@@ -82,6 +82,9 @@ unsigned int natoms;	/* we report this so we can tune the hash properly */
 typedef struct _hash_bucket {
     struct _hash_bucket	*next;
     hash_t		hash;
+#ifdef COMPACT_REFS
+    hash_t		pad;	/* keep the string referenceable */
+#endif /* COMPACT_REFS */
     char		string[0];
 } hash_bucket_t;
 
@@ -107,7 +110,7 @@ collision:
     }
 #ifdef THREADS
     if (threads > 1)
-	pthread_mutex_lock(&bucket_mutex);
+	TRACE_LOCK(&bucket_mutex, "atom bucket_mutex");
 #endif /* THREADS */
     if ((b = *head)) {
 #ifdef THREADS
@@ -118,7 +121,7 @@ collision:
     }
 
     len = strlen(string);
-    b = xmalloc(sizeof(hash_bucket_t) + len + 1, __func__);
+    b = compact_alloc(sizeof(hash_bucket_t) + len + 1, __func__);
     b->next = 0;
     b->hash = hash;
     memcpy(b->string, string, len + 1);
@@ -162,7 +165,7 @@ atom_cvs_number(const cvs_number n)
     }
 #ifdef THREADS
     if (threads > 1)
-	pthread_mutex_lock(&number_bucket_mutex);
+	TRACE_LOCK(&number_bucket_mutex, "number_bucket_mutex");
 #endif /* THREADS */
     if ((b = *head)) {
 #ifdef THREADS
@@ -172,7 +175,7 @@ atom_cvs_number(const cvs_number n)
 	goto collision;
     }
 
-    b = xmalloc(sizeof(number_bucket_t), __func__);
+    b = compact_alloc(sizeof(number_bucket_t), __func__);
     b->next = NULL;
     memcpy(&b->number, &n, sizeof(cvs_number));
     *head = b;
@@ -182,6 +185,43 @@ atom_cvs_number(const cvs_number n)
 #endif /* THREADS */
     return &b->number;
 }
+
+void
+atom_hash_stats(FILE *fp)
+/* report how well the string and number tables are sized */
+{
+    hash_stats	strings = {.name = "string atoms", .hashed = true};
+    hash_stats	numbers = {.name = "number atoms", .hashed = true};
+    int		i;
+
+    for (i = 0; i < HASH_SIZE; i++) {
+	const hash_bucket_t *b, *c;
+	size_t length = 0;
+
+	for (b = buckets[i]; b; b = b->next, length++)
+	    for (c = buckets[i]; c != b; c = c->next)
+		if (c->hash == b->hash) {
+		    strings.collisions++;
+		    break;
+		}
+	hash_stats_chain(&strings, length);
+    }
+    for (i = 0; i < NUMBER_HASH_SIZE; i++) {
+	const number_bucket_t *b, *c;
+	size_t length = 0;
+
+	for (b = number_buckets[i]; b; b = b->next, length++)
+	    for (c = number_buckets[i]; c != b; c = c->next)
+		if (hash_cvs_number(&c->number) == hash_cvs_number(&b->number)) {
+		    numbers.collisions++;
+		    break;
+		}
+	hash_stats_chain(&numbers, length);
+    }
+    hash_stats_report(fp, &strings);
+    hash_stats_report(fp, &numbers);
+}
+
 void
 discard_atoms(void)
 /* empty all string buckets */
@@ -191,12 +231,14 @@ discard_atoms(void)
 
 #ifdef THREADS
     if (threads > 1)
-	pthread_mutex_lock(&bucket_mutex);
+	TRACE_LOCK(&bucket_mutex, "atom bucket_mutex");
 #endif /* THREADS */
     for (i = 0; i < HASH_SIZE; i++)
 	for (head = &buckets[i]; (b = *head);) {
 	    *head = b->next;
+#ifndef COMPACT_REFS
 	    free(b);
+#endif /* COMPACT_REFS */
 	}
 #ifdef THREADS
     if (threads > 1) {
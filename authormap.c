@@ -4,6 +4,7 @@
  *  SPDX-License-Identifier: GPL-2.0+
  */
 
+#include <limits.h>
 #include "cvs.h"
 #include "hash.h"
 
@@ -32,6 +33,285 @@ fullname(const char *name)
     return NULL;
 }
 
+void
+author_hash_stats(FILE *fp)
+/* report how well the author-map table is sized */
+{
+    hash_stats	authors = {.name = "author map"};
+    int		h;
+
+    for (h = 0; h < AUTHOR_HASH; h++) {
+	const cvs_author *a;
+	size_t length = 0;
+
+	for (a = author_buckets[h]; a; a = a->next)
+	    length++;
+	hash_stats_chain(&authors, length);
+    }
+    hash_stats_report(fp, &authors);
+}
+
+/*
+ * Timezones named in the author map are compiled once into a table of
+ * the instants at which their UTC offset changes, so that commit
+ * headers can be stamped without setting TZ and calling tzset() for
+ * every commit.  The C library has no interface that lists a zone's
+ * transitions, so the table is found by sampling localtime_r() every
+ * TZ_SAMPLE seconds across the whole range of dates CVS can record,
+ * and bisecting to the second wherever the offset differs between
+ * samples.  That misses a change that is undone within a day; no real
+ * zone has one.  Each zone costs about 54,000 samples, once.
+ */
+
+#define TZ_SAMPLE	(24 * 60 * 60)
+#define TZ_SPAN_END	(sizeof(time_t) > 4 ? (time_t)RCS_EPOCH + UINT32_MAX \
+			 : (time_t)INT32_MAX)
+
+struct tz_transition {
+    time_t	start;
+    int		offset;		/* seconds east of UTC */
+};
+
+struct _tz_table {
+    struct _tz_table	*next;
+    const char		*name;		/* an atom */
+    size_t		ntransitions, stransitions;
+    struct tz_transition *transitions;
+};
+
+static tz_table	*tz_tables;
+
+static int
+tz_sample(const time_t t)
+/* the current zone's offset at t */
+{
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    return (int)(utc_time(&tm) - t);
+}
+
+static void
+tz_transition_add(tz_table *zone, const time_t start, const int offset)
+{
+    if (zone->ntransitions == zone->stransitions) {
+	zone->stransitions = zone->stransitions ? zone->stransitions * 2 : 64;
+	zone->transitions = xrealloc(zone->transitions,
+				     zone->stransitions * sizeof(struct tz_transition),
+				     __func__);
+    }
+    zone->transitions[zone->ntransitions].start = start;
+    zone->transitions[zone->ntransitions++].offset = offset;
+}
+
+const tz_table *
+tz_compile(const char *name)
+/* resolve a timezone to its offsets; not thread-safe, as it sets TZ */
+{
+    char	oldtz[PATH_MAX];
+    bool	hadtz;
+    tz_table	*zone;
+    time_t	t;
+    int		offset;
+
+    name = atom(name);
+    for (zone = tz_tables; zone; zone = zone->next)
+	if (zone->name == name)
+	    return zone;
+    zone = xcalloc(1, sizeof(tz_table), __func__);
+    zone->name = name;
+    zone->next = tz_tables;
+    tz_tables = zone;
+    if (strcmp(name, "UTC") == 0) {
+	tz_transition_add(zone, 0, 0);
+	return zone;
+    }
+
+    /* coverity[tainted_string_return_content] */
+    if ((hadtz = getenv("TZ") != NULL)) {
+	strncpy(oldtz, getenv("TZ"), sizeof(oldtz) - 1);
+	oldtz[sizeof(oldtz) - 1] = '\0';
+    }
+    setenv("TZ", name, 1);
+    tzset();
+
+    offset = tz_sample(0);
+    tz_transition_add(zone, 0, offset);
+    for (t = 0; t < TZ_SPAN_END - TZ_SAMPLE; ) {
+	time_t lo = t, hi = t + TZ_SAMPLE;
+
+	if (tz_sample(hi) == offset) {
+	    t = hi;
+	    continue;
+	}
+	while (hi - lo > 1) {
+	    time_t mid = lo + (hi - lo) / 2;
+	    if (tz_sample(mid) == offset)
+		lo = mid;
+	    else
+		hi = mid;
+	}
+	offset = tz_sample(hi);
+	tz_transition_add(zone, hi, offset);
+	t = hi;
+    }
+
+    if (hadtz)
+	setenv("TZ", oldtz, 1);
+    else
+	unsetenv("TZ");
+    tzset();
+    return zone;
+}
+
+int
+tz_offset(const tz_table *zone, const time_t t)
+/* a zone's offset from UTC at t, in seconds east */
+{
+    size_t lo = 0, hi = zone->ntransitions;
+
+    /* the last transition at or before t; earlier times take the first */
+    while (hi - lo > 1) {
+	size_t mid = lo + (hi - lo) / 2;
+	if (zone->transitions[mid].start <= t)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    return zone->transitions[lo].offset;
+}
+
+/*
+ * The set of committer IDs reported by -a, collected straight from the
+ * parsed masters so the report needs no collation.  It is keyed on the
+ * atomized author pointer, open-addressed and kept under half full,
+ * and remembers each author's earliest commit so that the list comes
+ * out in order of first appearance.
+ */
+#define SEEN_INITIAL	256	/* must be a power of 2 */
+
+typedef struct _author_seen {
+    const char	*name;
+    cvstime_t	first;
+} author_seen;
+
+static author_seen	*seen;
+static size_t		seen_mask, nseen;
+
+static size_t
+seen_slot(const char *name)
+{
+    return (size_t)HASH_VALUE(name) & seen_mask;
+}
+
+static void
+seen_add(const char *name, const cvstime_t date)
+/* enter one commit's author in the set */
+{
+    size_t i;
+
+    for (i = seen_slot(name); seen[i].name; i = (i + 1) & seen_mask)
+	if (seen[i].name == name) {
+	    if (date < seen[i].first)
+		seen[i].first = date;
+	    return;
+	}
+    seen[i].name = name;
+    seen[i].first = date;
+    if (++nseen * 2 > seen_mask) {
+	author_seen *old = seen;
+	size_t j, oldsize = seen_mask + 1;
+
+	seen_mask = oldsize * 2 - 1;
+	seen = xcalloc(oldsize * 2, sizeof(author_seen), "author set");
+	for (j = 0; j < oldsize; j++)
+	    if (old[j].name) {
+		for (i = seen_slot(old[j].name); seen[i].name; i = (i + 1) & seen_mask)
+		    continue;
+		seen[i] = old[j];
+	    }
+	free(old);
+    }
+}
+
+void
+author_collect(const cvs_master *cm)
+/* note the author of every commit in a master; callers serialize this */
+{
+    const rev_ref *h;
+    const cvs_commit *c;
+
+    if (seen == NULL) {
+	seen_mask = SEEN_INITIAL - 1;
+	seen = xcalloc(SEEN_INITIAL, sizeof(author_seen), "author set");
+    }
+    for (h = cm->heads; h; h = h->next) {
+	if (h->tail)
+	    continue;
+	for (c = h->commit; c; c = CREF_GET(cvs_commit, c->parent)) {
+	    seen_add(CREF_GET(const char, c->author), c->date);
+	    if (c->tail)
+		break;
+	}
+    }
+}
+
+static int
+seen_compare(const void *a, const void *b)
+/* earliest first; authors who first commit together sort by name */
+{
+    const author_seen *sa = a, *sb = b;
+
+    if (sa->first != sb->first)
+	return sa->first < sb->first ? -1 : 1;
+    return strcmp(sa->name, sb->name);
+}
+
+const char **
+author_list(size_t *count)
+/* the collected authors in order of first commit; caller frees */
+{
+    author_seen	*sorted = xmalloc(nseen * sizeof(author_seen) + 1, "author list");
+    const char	**names = xmalloc(nseen * sizeof(char *) + 1, "author list");
+    size_t	i, n = 0;
+
+    if (seen != NULL)
+	for (i = 0; i <= seen_mask; i++)
+	    if (seen[i].name)
+		sorted[n++] = seen[i];
+    qsort(sorted, n, sizeof(author_seen), seen_compare);
+    for (i = 0; i < n; i++)
+	names[i] = sorted[i].name;
+    free(sorted);
+    *count = n;
+    return names;
+}
+
+void
+author_seen_stats(FILE *fp)
+/* report on the -a author set, probe sequences standing in for chains */
+{
+    hash_stats	authors = {.name = "author set"};
+    size_t	i, j;
+
+    if (seen == NULL)
+	return;
+    authors.buckets = seen_mask + 1;
+    for (i = 0; i <= seen_mask; i++) {
+	size_t probes = 1;
+
+	if (seen[i].name == NULL)
+	    continue;
+	authors.used++;
+	authors.entries++;
+	for (j = seen_slot(seen[i].name); j != i; j = (j + 1) & seen_mask)
+	    probes++;
+	if (probes > authors.longest)
+	    authors.longest = probes;
+    }
+    hash_stats_report(fp, &authors);
+}
+
 void
 free_author_map(void)
 /* discard author-map information */
@@ -47,6 +327,15 @@ free_author_map(void)
 	    free(a);
 	}
     }
+    while (tz_tables) {
+	tz_table *zone = tz_tables;
+	tz_tables = zone->next;
+	free(zone->transitions);
+	free(zone);
+    }
+    free(seen);
+    seen = NULL;
+    nseen = 0;
 }
 
 bool
@@ -128,6 +417,7 @@ load_author_map(const char *filename)
 		    break;
 	    }
 	    a->timezone = atom(angle);
+	    a->zone = tz_compile(a->timezone);
 	}
 	bucket = &author_buckets[author_hash(name)];
 	a->next = *bucket;
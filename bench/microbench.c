@@ -0,0 +1,544 @@
+/*
+ * microbench - time the inner kernels of cvs-fast-export on fixed inputs
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ * Each kernel runs over a corpus generated from a fixed seed, so two
+ * builds of this program time exactly the same work and the numbers can
+ * be compared directly.  Kernels that are static to their modules are
+ * reached by including the module source, the same trick revdir.c uses
+ * to pick up its packing strategy; link this against every object
+ * except main.o, generate.o, hash.o and export.o.
+ *
+ * usage: microbench [-t seconds] [-l] [kernel...]
+ */
+
+#include "../export.c"		/* first, for its feature-test macros */
+#include "../generate.c"
+#include "../hash.c"
+#include "../revdir.h"
+#include <getopt.h>
+
+/* what main.c would otherwise provide */
+int commit_time_window = 300;
+bool trust_commitids = true;
+bool progress = false;
+FILE *LOGFILE;
+int threads = NO_MAX;
+
+void gather_stats(const char *legend)
+{
+}
+
+void gather_thread_stats(void)
+{
+}
+
+#define NPATHS		4096	/* pathnames in the corpus */
+#define NNUMBERS	4096	/* revision numbers in the corpus */
+#define NLINES		2000	/* lines in the edit-buffer revision */
+#define NDELTAS		256	/* edit scripts applied to it */
+#define NFILES		2000	/* files in each packed revdir */
+
+static uint32_t seed = 20061212;
+static volatile hash_t sink;	/* keeps results live */
+
+static uint32_t
+lcg(void)
+/* small portable generator, so every libc sees the same corpus */
+{
+    seed = seed * 1103515245U + 12345U;
+    return seed >> 8;
+}
+
+static const char *const words[] = {
+    "src", "lib", "doc", "include", "tests", "util", "net", "gui",
+    "Attic", "kernel", "drivers", "fs", "arch", "x86", "common", "tools",
+};
+#define NWORDS	(sizeof(words) / sizeof(words[0]))
+
+static char *paths[NPATHS];
+static cvs_number numbers[NNUMBERS];
+
+static void
+make_paths(void)
+/* pathnames one to five directories deep, sharing prefixes like a real tree */
+{
+    char buf[PATH_MAX];
+    int i;
+
+    for (i = 0; i < NPATHS; i++) {
+	int depth = 1 + lcg() % 5, d;
+	size_t len = 0;
+
+	for (d = 0; d < depth; d++)
+	    len += sprintf(buf + len, "%s/", words[lcg() % (d ? NWORDS : 4)]);
+	len += sprintf(buf + len, "file%u.c,v", lcg() % 512);
+	paths[i] = memcpy(xmalloc(len + 1, __func__), buf, len + 1);
+    }
+}
+
+static void
+make_numbers(void)
+/* trunk revisions mostly, with some branches and branches of branches */
+{
+    int i;
+
+    for (i = 0; i < NNUMBERS; i++) {
+	cvs_number *n = &numbers[i];
+	int shape = lcg() % 8;
+
+	n->c = 2;
+	n->n[0] = 1;
+	n->n[1] = 1 + lcg() % 200;
+	if (shape >= 5) {
+	    n->n[n->c++] = 2 * (1 + lcg() % 4);
+	    n->n[n->c++] = 1 + lcg() % 20;
+	}
+	if (shape == 7) {
+	    n->n[n->c++] = 2 * (1 + lcg() % 2);
+	    n->n[n->c++] = 1 + lcg() % 5;
+	}
+    }
+}
+
+static size_t
+run_path_deep_compare(void)
+{
+    hash_t h = 0;
+    int i;
+
+    for (i = 0; i < NPATHS; i++)
+	h += path_deep_compare(paths[i], paths[(i * 7 + 1) % NPATHS]);
+    sink = h;
+    return NPATHS;
+}
+
+static size_t
+run_atom(void)
+/* the hit path, which is what nearly every call takes */
+{
+    hash_t h = 0;
+    int i;
+
+    for (i = 0; i < NPATHS; i++)
+	h += (uintptr_t)atom(paths[i]);
+    sink = h;
+    return NPATHS;
+}
+
+static size_t
+run_atom_cvs_number(void)
+{
+    hash_t h = 0;
+    int i;
+
+    for (i = 0; i < NNUMBERS; i++)
+	h += (uintptr_t)atom_cvs_number(numbers[i]);
+    sink = h;
+    return NNUMBERS;
+}
+
+static size_t
+run_fnv1a(void)
+{
+    hash_t h = 0;
+    int i;
+
+    for (i = 0; i < NPATHS; i++)
+	h += fnv1a_hash_string(paths[i]);
+    sink = h;
+    return NPATHS;
+}
+
+static size_t
+run_word_hash(void)
+{
+    hash_t h = 0;
+    int i;
+
+    for (i = 0; i < NPATHS; i++)
+	h += word_hash_string(paths[i]);
+    sink = h;
+    return NPATHS;
+}
+
+static size_t
+run_crc32(void)
+{
+    hash_t h = 0;
+    int i;
+
+    for (i = 0; i < NPATHS; i++)
+	h += crc32(paths[i]);
+    sink = h;
+    return NPATHS;
+}
+
+static size_t
+run_hash_value(void)
+/* the HASH_VALUE() form, hashing a revision number in place */
+{
+    hash_t h = 0;
+    int i;
+
+    for (i = 0; i < NNUMBERS; i++)
+	h += HASH_VALUE(numbers[i]);
+    sink = h;
+    return NNUMBERS;
+}
+
+static size_t
+run_cvs_number_compare(void)
+{
+    hash_t h = 0;
+    int i;
+
+    for (i = 0; i < NNUMBERS; i++)
+	h += cvs_number_compare(&numbers[i], &numbers[(i * 7 + 1) % NNUMBERS]);
+    sink = h;
+    return NNUMBERS;
+}
+
+/*
+ * The edit-buffer kernels share one master: a NLINES-line head
+ * revision, about one line in eight carrying a keyword and one in
+ * sixteen an escaped @, and NDELTAS edit scripts that each replace a
+ * few lines scattered through the file.  Every script deletes as many
+ * lines as it adds, so they can be applied over and over.
+ */
+static editbuffer_t ebstore, *eb = &ebstore;
+static uchar *headtext;
+static uchar *deltatext[NDELTAS];
+static node_t headnode, deltanode;
+static cvs_version version;
+static cvs_patch patch;
+static cvs_number versionnumber = {2, {1, 42}};
+
+static uchar *
+make_line(uchar *p, int n)
+/* write line N of a revision, with its @s doubled */
+{
+    switch (lcg() % 16) {
+    case 0:
+	return p + sprintf((char *)p, "/* $Id$ line %d */\n", n);
+    case 1:
+	return p + sprintf((char *)p, "#define REV \"$Revision$\" /* %d */\n", n);
+    case 2:
+	return p + sprintf((char *)p, "    mail(\"user@@example.com\"); /* %d */\n", n);
+    default:
+	return p + sprintf((char *)p, "    value%d = compute(value%u, %u);\n",
+			   n, lcg() % NLINES, lcg() % 100);
+    }
+}
+
+static void
+make_edits(void)
+{
+    uchar *p;
+    int i, j;
+
+    p = headtext = xmalloc(NLINES * 64 + 3, __func__);
+    *p++ = SDELIM;
+    for (i = 0; i < NLINES; i++)
+	p = make_line(p, i);
+    strcpy((char *)p, "@ ");
+
+    for (i = 0; i < NDELTAS; i++) {
+	int nedits = 1 + lcg() % 4;
+	long line1 = 0;
+
+	p = deltatext[i] = xmalloc(nedits * 96 + 3, __func__);
+	*p++ = SDELIM;
+	for (j = 0; j < nedits; j++) {
+	    line1 += 1 + lcg() % (NLINES / nedits - 1);
+	    p += sprintf((char *)p, "d%ld 1\na%ld 1\n", line1, line1);
+	    p = make_line(p, line1);
+	}
+	strcpy((char *)p, "@ ");
+    }
+
+    version.number = &versionnumber;
+    version.author = "jrandom";
+    version.state = "Exp";
+    version.date = 800000000;
+    patch.log = "microbenchmark\n";
+    headnode.version = deltanode.version = &version;
+    headnode.patch = deltanode.patch = &patch;
+
+    eb->current = eb->stack;
+    eb->Gfilename = "src/microbench.c,v";
+    eb->Gexpand = EXPANDKKV;
+    Gline(eb) = NULL; Ggap(eb) = Ggapsize(eb) = Glinemax(eb) = 0;
+    Gnode_text(eb) = headtext;
+    process_delta(eb, &headnode, ENTER);
+}
+
+static size_t
+run_process_delta(void)
+{
+    int i;
+
+    for (i = 0; i < NDELTAS; i++) {
+	Gnode_text(eb) = deltatext[i];
+	process_delta(eb, &deltanode, EDIT);
+    }
+    return NDELTAS;
+}
+
+static size_t
+run_gap_edit(void)
+/* insertline()/deletelines() alone, walking the gap across the file */
+{
+    int i;
+
+    for (i = 0; i < NDELTAS; i++) {
+	unsigned long n = (i * 997UL) % NLINES;
+#ifdef LINESTATS
+	editline_t l = Gline(eb)[n < Ggap(eb) ? n : n + Ggapsize(eb)];
+	deletelines(eb, n, 1);
+	eb->line_len = l.length;
+	eb->has_stringdelim = l.has_stringdelim;
+	insertline(eb, n, l.ptr);
+#else
+	uchar *l = Gline(eb)[n < Ggap(eb) ? n : n + Ggapsize(eb)];
+	deletelines(eb, n, 1);
+	insertline(eb, n, l);
+#endif
+    }
+    return NDELTAS;
+}
+
+static size_t
+run_snapshotedit(void)
+{
+    out_buffer_init(eb);
+    snapshotedit(eb);
+    sink = out_buffer_count(eb);
+    out_buffer_cleanup(eb);
+    return 1;
+}
+
+static size_t
+run_expandedit(void)
+{
+    out_buffer_init(eb);
+    expandedit(eb);
+    sink = out_buffer_count(eb);
+    out_buffer_cleanup(eb);
+    return 1;
+}
+
+/*
+ * The revdir kernels pack NFILES masters spread through the corpus
+ * directories.  Each master has two revisions; successive packs flip
+ * a few of them, the way one changeset differs from its parent.
+ */
+static master_dir **dirs;
+static size_t ndirs;
+static cvs_commit *revisions[NFILES][2];
+static const cvs_commit *packfiles[NFILES];
+static size_t npacked;
+static revdir packed[2];
+static git_commit *fileop_commits[2];	/* parent and child of the two packs */
+
+static const master_dir *
+make_dir(const char *name)
+/* intern a directory and its ancestors, as atom_dir() does */
+{
+    char buf[PATH_MAX];
+    char *slash;
+    master_dir *d;
+    size_t i;
+
+    name = atom(name);
+    for (i = 0; i < ndirs; i++)
+	if (dirs[i]->name == name)
+	    return dirs[i];
+    d = compact_alloc(sizeof(master_dir), __func__);
+    d->name = name;
+    if (name[0]) {
+	strcpy(buf, name);
+	slash = strrchr(buf, '/');
+	*(slash ? slash : buf) = '\0';
+	d->parent = make_dir(buf);
+    }
+    dirs = xrealloc(dirs, sizeof(master_dir *) * ++ndirs, __func__);
+    return dirs[ndirs - 1] = d;
+}
+
+static int
+master_compare(const void *a, const void *b)
+{
+    return path_deep_compare(*(char * const *)a, *(char * const *)b);
+}
+
+static void
+make_revdirs(void)
+{
+    const char *names[NFILES];
+    char buf[PATH_MAX];
+    int i, j, n = 0;
+
+    root_dir = make_dir("");
+    for (i = 0; i < NPATHS && n < NFILES; i++) {
+	const char *name = atom(paths[i]);
+	for (j = 0; j < n; j++)
+	    if (names[j] == name)
+		break;
+	if (j == n)
+	    names[n++] = name;
+    }
+    qsort(names, n, sizeof(char *), master_compare);
+    for (i = 0; i < n; i++) {
+	rev_master *m = compact_alloc(sizeof(rev_master), __func__);
+	char *slash;
+
+	m->name = m->fileop_name = names[i];
+	strcpy(buf, names[i]);
+	slash = strrchr(buf, '/');
+	*slash = '\0';
+	m->dir = make_dir(buf);
+	for (j = 0; j < 2; j++) {
+	    cvs_commit *c = compact_alloc(sizeof(cvs_commit), __func__);
+	    CREF_SET(c->master, m);
+	    CREF_SET(c->dir, m->dir);
+	    revisions[i][j] = c;
+	}
+	packfiles[i] = revisions[i][0];
+    }
+    npacked = n;
+    revdir_pack_files(packfiles, npacked, &packed[0]);
+    for (j = 0; j < 32; j++) {
+	i = lcg() % npacked;
+	packfiles[i] = revisions[i][1];
+    }
+    revdir_pack_files(packfiles, npacked, &packed[1]);
+    for (j = 0; j < 2; j++) {
+	fileop_commits[j] = compact_alloc(sizeof(git_commit), __func__);
+	fileop_commits[j]->revdir = packed[j];
+    }
+    CREF_SET(fileop_commits[1]->parent, fileop_commits[0]);
+}
+
+static size_t
+run_revdir_pack_files(void)
+{
+    revdir scratch;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+	size_t f = lcg() % npacked;
+	packfiles[f] = revisions[f][packfiles[f] == revisions[f][0]];
+	revdir_pack_files(packfiles, npacked, &scratch);
+    }
+    return 16;
+}
+
+static size_t
+run_build_fileops(void)
+/* the file-level merge join export.c does for every commit */
+{
+    static export_options_t opts;
+    static struct fileop *operations;
+    static int noperations = 32;	/* export.c #undefs its OP_CHUNK */
+    struct fileop *op;
+
+    if (operations == NULL)
+	operations = xmalloc(sizeof(struct fileop) * noperations, __func__);
+    op = build_fileops(fileop_commits[1], &opts, &operations, operations,
+		       &noperations, NULL, NULL);
+    sink = op - operations;
+    return 1;
+}
+
+static struct kernel {
+    const char *name;
+    const char *op;
+    size_t (*run)(void);
+} kernels[] = {
+    {"path_deep_compare", "compare", run_path_deep_compare},
+    {"atom", "lookup", run_atom},
+    {"atom_cvs_number", "lookup", run_atom_cvs_number},
+    {"fnv1a", "pathname", run_fnv1a},
+    {"word_hash", "pathname", run_word_hash},
+    {"crc32", "pathname", run_crc32},
+    {"hash_value", "revision number", run_hash_value},
+    {"cvs_number_compare", "compare", run_cvs_number_compare},
+    {"process_delta", "edit script", run_process_delta},
+    {"gap_edit", "line replaced", run_gap_edit},
+    {"snapshotedit", "2000-line revision", run_snapshotedit},
+    {"expandedit", "2000-line revision", run_expandedit},
+    {"revdir_pack_files", "2000-file pack", run_revdir_pack_files},
+    {"build_fileops", "2000-file diff", run_build_fileops},
+};
+#define NKERNELS	(sizeof(kernels) / sizeof(kernels[0]))
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+time_kernel(const struct kernel *k, double mintime)
+/* repeat a kernel for at least mintime seconds and report its cost */
+{
+    double start, elapsed;
+    size_t ops = 0;
+
+    k->run();		/* warm caches and the atom table */
+    start = now();
+    do {
+	ops += k->run();
+	elapsed = now() - start;
+    } while (elapsed < mintime);
+    printf("%-20s %12.1f ns/op  %10zu ops  (op = %s)\n",
+	   k->name, elapsed * 1e9 / ops, ops, k->op);
+}
+
+int
+main(int argc, char **argv)
+{
+    double mintime = 0.5;
+    size_t i;
+    int c, j;
+
+    while ((c = getopt(argc, argv, "lt:")) != EOF) {
+	switch (c) {
+	case 'l':
+	    for (i = 0; i < NKERNELS; i++)
+		puts(kernels[i].name);
+	    return 0;
+	case 't':
+	    mintime = atof(optarg);
+	    break;
+	default:
+	    fprintf(stderr, "usage: microbench [-t seconds] [-l] [kernel...]\n");
+	    return 1;
+	}
+    }
+
+    threads = 1;
+    LOGFILE = stderr;
+    make_paths();
+    make_numbers();
+    make_edits();
+    make_revdirs();
+
+    for (i = 0; i < NKERNELS; i++) {
+	if (optind < argc) {
+	    for (j = optind; j < argc; j++)
+		if (!strcmp(argv[j], kernels[i].name))
+		    break;
+	    if (j == argc)
+		continue;
+	}
+	time_kernel(&kernels[i], mintime);
+    }
+    return 0;
+}
+
+/* end */
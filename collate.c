@@ -4,7 +4,11 @@
  *  SPDX-License-Identifier: GPL-2.0+
  */
 #include "cvs.h"
+#include "hash.h"
 #include "revdir.h"
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
 /*
  * These functions analyze a CVS revlist into a changeset DAG.
  *
@@ -15,6 +19,10 @@
  * Pack the dead flag into the commit pointer so we can avoid dereferencing
  * in the inner loop. Also keep the dir near the packed pointer
  * as it is used in the inner loop.
+ *
+ * The next bit up marks a commit reached on the parent branch, where
+ * this branch's walk stops.  Keeping it here rather than in the commit
+ * lets sibling branches that share a branch point collate concurrently.
  */
 typedef struct _revision {
     /* packed commit pointer and dead flag */
@@ -29,10 +37,12 @@ typedef struct _revision {
 #define REVISION_T_PACK(rev, commit) (rev).packed = ((uintptr_t)(commit) | ((commit) ? ((commit)->dead) : 0))
 #define REVISION_T_PACK_INIT(rev, commit) do {	\
 	REVISION_T_PACK(rev, commit);		\
-	(rev).dir = (commit)->master->dir;	\
+	(rev).dir = CREF_GET(const rev_master, (commit)->master)->dir;	\
     } while (0)
 #define REVISION_T_DEAD(rev) (((rev).packed) & 1)
-#define COMMIT_MASK (~(uintptr_t)0 ^ 1)
+#define REVISION_T_TAILED(rev) ((((rev).packed) >> 1) & 1)
+#define REVISION_T_SET_TAILED(rev) ((rev).packed |= 2)
+#define COMMIT_MASK (~(uintptr_t)0 ^ 3)
 #define REVISION_T_COMMIT(rev) (cvs_commit *)(((rev).packed) & (COMMIT_MASK))
 
 /*
@@ -40,96 +50,295 @@ typedef struct _revision {
  * is in scope
  */
 #define DEAD(index) (REVISION_T_DEAD(revisions[(index)]))
+#define TAILED(index) (REVISION_T_TAILED(revisions[(index)]))
 #define REVISIONS(index) (REVISION_T_COMMIT(revisions[(index)]))
 #define DIR(index) (revisions[(index)].dir)
 
-static rev_ref *
-rev_find_head(head_list *rl, const char *name)
-/* find a named branch head in a revlist - used on both CVS and gitspace sides */
+/*
+ * The gitspace DAG lives until export is done; the branch and tag
+ * indexes only until collate_to_changesets() returns.  Both are built
+ * from many small objects, so carve them out of arenas.
+ */
+static arena_t	gitspace_arena;
+static arena_t	collate_arena;
+#ifdef THREADS
+static pthread_mutex_t	gitspace_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif /* THREADS */
+
+static void *
+gitspace_alloc(size_t size, const char *legend)
+/* zeroed storage that lives until collate_free() */
 {
-    rev_ref	*h;
-
-    for (h = rl->heads; h; h = h->next)
-	if (h->ref_name == name)
-	    return h;
-    return NULL;
+    void *ret;
+
+#ifdef THREADS
+    if (threads > 1)
+	TRACE_LOCK(&gitspace_mutex, "gitspace_mutex");
+#endif /* THREADS */
+    ret = arena_alloc(&gitspace_arena, size, legend);
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_unlock(&gitspace_mutex);
+#endif /* THREADS */
+    return ret;
 }
 
-static rev_ref *
-rev_ref_find_name(rev_ref *h, const char *name)
-/* find a revision reference by name */
+void
+collate_free(void)
+/* release the gitspace DAG */
 {
-    for (; h; h = h->next)
-	if (h->ref_name == name)
-	    return h;
-    return NULL;
+    arena_free(&gitspace_arena);
 }
 
-static bool
-parents_in_revlist(const char *child_name, rev_ref *rev_list,
-		   cvs_master *source, size_t nsource)
 /*
- * See whether all the parents of child_name are in rev_list
- * If child_name has no parents (e.g. master branch) then this is
- * trivally true.
- *
- * Parent branch names are determined by examining every cvs master.  See the
- * general note on branch matching under collate_changesets().
+ * Index from a branch name to its gitspace head and to the CVS heads
+ * of that name, one per master in master order, that collate into it.
+ * Built once so branch matching doesn't walk every master's head list.
  */
+typedef struct _branch_clique {
+    struct _branch_clique	*next;
+    const char			*ref_name;
+    rev_ref			*head;		/* gitspace branch head */
+    rev_ref			**refs;		/* per-master CVS heads */
+    size_t			nrefs, srefs;
+    const cvs_master		*last;		/* master of refs[nrefs-1] */
+    /* toposort state */
+    struct _branch_clique	**children;	/* cliques branching from us */
+    size_t			nchildren, schildren;
+    size_t			order;		/* position in gitspace list */
+    size_t			nparents;	/* parents not yet sorted */
+    const struct _branch_clique	*stamp;		/* last child linked */
+} branch_clique;
+
+#define BRANCH_HASH 4093
+
+static branch_clique	*branch_buckets[BRANCH_HASH];
+
+static unsigned
+branch_hash(const char *name)
+{
+    HASH_INIT(h);
+    HASH_MIX(h, name);
+    return h % BRANCH_HASH;
+}
+
+static branch_clique *
+branch_clique_find(const char *name)
+/* find the clique for a branch name; names are atoms, so compare pointers */
+{
+    branch_clique	*b;
+
+    for (b = branch_buckets[branch_hash(name)]; b; b = b->next)
+	if (b->ref_name == name)
+	    return b;
+    return NULL;
+}
+
+static branch_clique *
+branch_clique_add(const cvs_master *cm, rev_ref *lh)
+/* enter a CVS branch head in its clique, creating the clique if needed */
+{
+    branch_clique	**bucket = &branch_buckets[branch_hash(lh->ref_name)];
+    branch_clique	*b;
+
+    for (b = *bucket; b; b = b->next)
+	if (b->ref_name == lh->ref_name)
+	    break;
+    if (!b) {
+	b = arena_alloc(&collate_arena, sizeof(branch_clique), "branch index");
+	b->ref_name = lh->ref_name;
+	b->next = *bucket;
+	*bucket = b;
+    }
+    /* like a linear search, only the first head of a name in a master counts */
+    if (b->last == cm)
+	return b;
+    if (b->nrefs == b->srefs) {
+	b->srefs = b->srefs ? b->srefs * 2 : 4;
+	b->refs = xrealloc(b->refs, b->srefs * sizeof(rev_ref *),
+			   "branch index");
+    }
+    b->refs[b->nrefs++] = lh;
+    b->last = cm;
+    return b;
+}
+
+static void
+branch_clique_free(void)
+/* discard the branch index */
 {
-    cvs_master *cm;
-    for (cm = source; cm < source + nsource; cm++) {
-	rev_ref *head = rev_find_head(cm, child_name);
-	if (head) {
-	    if (head->parent && !rev_ref_find_name(rev_list, head->parent->ref_name))
-		    return false;
+    int	h;
+
+    for (h = 0; h < BRANCH_HASH; h++) {
+	branch_clique	*b;
+
+	while ((b = branch_buckets[h])) {
+	    branch_buckets[h] = b->next;
+	    free(b->refs);
+	    free(b->children);
 	}
     }
-    return true;
+}
+
+static void
+branch_clique_link(branch_clique *parent, branch_clique *child)
+/* record that child branches from parent, once per distinct pair */
+{
+    if (parent->stamp == child)
+	return;
+    parent->stamp = child;
+    if (parent->nchildren == parent->schildren) {
+	parent->schildren = parent->schildren ? parent->schildren * 2 : 4;
+	parent->children = xrealloc(parent->children,
+				    parent->schildren * sizeof(branch_clique *),
+				    "branch toposort");
+    }
+    parent->children[parent->nchildren++] = child;
+    child->nparents++;
+}
+
+static void
+branch_heap_push(size_t *heap, size_t *nheap, size_t order)
+/* add to a min-heap of gitspace list positions */
+{
+    size_t i = (*nheap)++;
+
+    while (i > 0 && heap[(i - 1) / 2] > order) {
+	heap[i] = heap[(i - 1) / 2];
+	i = (i - 1) / 2;
+    }
+    heap[i] = order;
+}
+
+static size_t
+branch_heap_pop(size_t *heap, size_t *nheap)
+/* remove the smallest list position from a min-heap */
+{
+    size_t top = heap[0], last = heap[--*nheap], i = 0, c;
+
+    while ((c = 2 * i + 1) < *nheap) {
+	if (c + 1 < *nheap && heap[c + 1] < heap[c])
+	    c++;
+	if (last <= heap[c])
+	    break;
+	heap[i] = heap[c];
+	i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+static void
+branch_cycle_report(branch_clique **cliques, size_t ncliques)
+/* name the branches making up one cycle among the unsorted cliques */
+{
+    branch_clique *b = NULL, *p;
+    size_t i, len;
+    char *msg;
+
+    for (i = 0; i < ncliques; i++)
+	if (cliques[i]->nparents) {
+	    b = cliques[i];
+	    break;
+	}
+    assert(b);
+    /*
+     * Every unsorted clique has an unsorted parent, so walking
+     * parent links from one must eventually revisit a clique.  Use
+     * the stamp field to mark the walk; the first clique seen twice
+     * is on a cycle.
+     */
+    for (i = 0; i < ncliques; i++)
+	cliques[i]->stamp = NULL;
+    while (!b->stamp) {
+	p = NULL;
+	for (i = 0; i < b->nrefs && !p; i++)
+	    if (b->refs[i]->parent) {
+		p = branch_clique_find(b->refs[i]->parent->ref_name);
+		if (!p->nparents)
+		    p = NULL;
+	    }
+	assert(p);
+	b->stamp = p;
+	b = p;
+    }
+    len = strlen(b->ref_name) + 1;
+    for (p = (branch_clique *)b->stamp; p != b; p = (branch_clique *)p->stamp)
+	len += strlen(p->ref_name) + 4;
+    msg = xmalloc(len, "branch cycle report");
+    strcpy(msg, b->ref_name);
+    for (p = (branch_clique *)b->stamp; p != b; p = (branch_clique *)p->stamp) {
+	strcat(msg, " <- ");
+	strcat(msg, p->ref_name);
+    }
+    announce("internal error - branch cycle: %s <- %s\n", msg, b->ref_name);
+    free(msg);
 }
 
 static rev_ref *
-rev_ref_tsort(rev_ref *git_branches, cvs_master *masters, size_t nmasters)
-/* Sort a list of git space branches so parents come before children */
+rev_ref_tsort(rev_ref *git_branches, size_t nbranches)
+/*
+ * Sort a list of git space branches so parents come before children.
+ *
+ * A branch's parents are determined by examining every cvs master.  See the
+ * general note on branch matching under collate_changesets().  This is
+ * Kahn's algorithm with the ready set ordered by position in the input
+ * list, so among branches whose parents are all sorted the earliest
+ * always goes next. That puts the (parentless) trunk first, and child
+ * branches after their respective parent branches.
+ */
 {
     rev_ref *sorted_git_branches = NULL;
     rev_ref **sorted_tail = &sorted_git_branches;
-    rev_ref *r, **prev;
-
-    while (git_branches) {
-	/* search the remaining input list */
-	for (prev = &git_branches; (r = *prev); prev = &(*prev)->next) {
-            /*
-	     * Find a branch where we've already sorted its parents.
-	     * Toposorting with this relation will put the (parentless) trunk first,
-	     * and child branches after their respective parent branches.
-	     */
-	    if (parents_in_revlist(r->ref_name, sorted_git_branches, masters, nmasters)) {
-		break;
-	    }
-	}
-	if (!r) {
-	    announce("internal error - branch cycle\n");
-	    return NULL;
-	}
-        /*
-         * Remove the found branch from the input list and
-         * append it to the output list
-         */
-	*prev = r->next;
+    branch_clique **cliques, *b;
+    size_t *heap, nheap = 0, nsorted = 0, i, j;
+    rev_ref *r;
+
+    cliques = xmalloc(nbranches * sizeof(branch_clique *), "branch toposort");
+    for (r = git_branches, i = 0; r; r = r->next, i++) {
+	cliques[i] = branch_clique_find(r->ref_name);
+	cliques[i]->order = i;
+    }
+    assert(i == nbranches);
+    for (i = 0; i < nbranches; i++) {
+	b = cliques[i];
+	for (j = 0; j < b->nrefs; j++)
+	    if (b->refs[j]->parent)
+		branch_clique_link(branch_clique_find(b->refs[j]->parent->ref_name), b);
+    }
+
+    heap = xmalloc(nbranches * sizeof(size_t), "branch toposort");
+    for (i = 0; i < nbranches; i++)
+	if (!cliques[i]->nparents)
+	    branch_heap_push(heap, &nheap, i);
+    while (nheap) {
+	b = cliques[branch_heap_pop(heap, &nheap)];
+	for (j = 0; j < b->nchildren; j++)
+	    if (--b->children[j]->nparents == 0)
+		branch_heap_push(heap, &nheap, b->children[j]->order);
+	/* append it to the output list */
+	r = b->head;
 	*sorted_tail = r;
 	r->next = NULL;
 	sorted_tail = &r->next;
+	nsorted++;
 	progress_step();
     }
+    if (nsorted < nbranches) {
+	branch_cycle_report(cliques, nbranches);
+	sorted_git_branches = NULL;
+    }
+    free(heap);
+    free(cliques);
     return sorted_git_branches;
 }
 
 static int
 cvs_commit_date_compare(const void *av, const void *bv)
 {
-    const cvs_commit	*a = REVISION_T_COMMIT(*(revision_t *) av);
-    const cvs_commit	*b = REVISION_T_COMMIT(*(revision_t *) bv);
+    const revision_t	*ra = av, *rb = bv;
+    const cvs_commit	*a = REVISION_T_COMMIT(*ra);
+    const cvs_commit	*b = REVISION_T_COMMIT(*rb);
     int			t;
 
     /*
@@ -144,8 +353,8 @@ cvs_commit_date_compare(const void *av, const void *bv)
     /*
      * tailed entries sort next
      */
-    if (a->tailed != b->tailed)
-	return(int)a->tailed - (int)b->tailed;
+    if (REVISION_T_TAILED(*ra) != REVISION_T_TAILED(*rb))
+	return (int)REVISION_T_TAILED(*ra) - (int)REVISION_T_TAILED(*rb);
     /*
      * Newest entries sort first
      */
@@ -242,25 +451,6 @@ cvs_commit_match(const cvs_commit *a, const cvs_commit *b)
     return true;
 }
 
-/*
- * These statics are part of an optimization to reduce allocation calls
- * by only doing one when more memory needs to be grabbed than the
- * previous commit build used.
- */
-static const cvs_commit **files = NULL;
-static int	        sfiles = 0;
-
-static void
-git_commit_cleanup(void)
-/* clean up after rev list collate */
-{
-    if (files) {
-	free(files);
-	files = NULL;
-	sfiles = 0;
-    }
-}
-
 static git_commit *
 git_commit_build(revision_t *revisions, const cvs_commit *leader, const int nrevisions)
 /* build a changeset commit from a clique of CVS revisions */
@@ -268,9 +458,14 @@ git_commit_build(revision_t *revisions, const cvs_commit *leader, const int nrev
     size_t     n;
     git_commit *commit;
 
-    commit = xmalloc(sizeof(git_commit), "creating commit");
+#ifdef COMPACT_REFS
+    /* CREF links must point into the compact heap */
+    commit = compact_alloc(sizeof(git_commit), "creating commit");
+#else
+    commit = gitspace_alloc(sizeof(git_commit), "creating commit");
+#endif /* COMPACT_REFS */
 
-    commit->parent = NULL;
+    CREF_SET(commit->parent, NULL);
     commit->date = leader->date;
     commit->commitid = leader->commitid;
     commit->log = leader->log;
@@ -293,13 +488,13 @@ git_commit_build(revision_t *revisions, const cvs_commit *leader, const int nrev
 #if !defined STREAMDIR
     for (n = 0; n < nfile; n++)
 	if (REVISIONS(n))
-	    debugmsg("%s\n", REVISIONS(n)->master->name);
+	    debugmsg("%s\n", CREF_GET(const rev_master, REVISIONS(n)->master)->name);
 #endif
     fputs("After packing:\n", LOGFILE);
     revdir_iter *i = revdir_iter_alloc(&commit->revdir);
     cvs_commit *c;
     while((c = revdir_iter_next(i)))
-	debugmsg("   file name: %s\n", c->master->name);
+	debugmsg("   file name: %s\n", CREF_GET(const rev_master, c->master)->name);
 
 #endif /* ORDERDEBUG */
 
@@ -313,7 +508,8 @@ git_commit_locate_date(const rev_ref *branch, const cvstime_t date)
     git_commit	*commit;
 
     /* PUNNING: see the big comment in cvs.h */
-    for (commit = (git_commit *)branch->commit; commit; commit = commit->parent)
+    for (commit = (git_commit *)branch->commit; commit;
+	 commit = CREF_GET(git_commit, commit->parent))
     {
 	if (time_compare(commit->date, date) <= 0)
 	    return commit;
@@ -333,7 +529,7 @@ git_commit_locate_one(const rev_ref *branch, const cvs_commit *part)
     /* PUNNING: see the big comment in cvs.h */
     for (commit = (git_commit *)branch->commit;
 	 commit;
-	 commit = commit->parent)
+	 commit = CREF_GET(git_commit, commit->parent))
     {
 	/* PUNNING: see the big comment in cvs.h */
 	if (cvs_commit_match((cvs_commit *)commit, part))
@@ -376,17 +572,18 @@ git_commit_locate(const rev_ref *branch, const cvs_commit *cm)
 }
 
 static rev_ref *
-git_branch_of_commit(const git_repo *gl, const cvs_commit *commit)
-/* return the gitspace branch head that owns a specified CVS commit */
+git_branch_of_commit(const git_repo *gl, const cvs_commit *commit,
+		     const rev_ref *skip)
+/* return the gitspace branch head other than skip that owns a CVS commit */
 {
     rev_ref	*h;
     cvs_commit	*c;
 
     for (h = gl->heads; h; h = h->next)
     {
-	if (h->tail)
+	if (h->tail || h == skip)
 	    continue;
-	for (c = h->commit; c; c = c->parent) {
+	for (c = h->commit; c; c = CREF_GET(cvs_commit, c->parent)) {
 	    if (cvs_commit_match(c, commit))
 		return h;
 	    if (c->tail)
@@ -401,23 +598,225 @@ cvs_commit_first_date(cvs_commit *commit)
 /* return time of first commit along entire history */
 {
     while (commit->parent)
-	commit = commit->parent;
+	commit = CREF_GET(cvs_commit, commit->parent);
     return commit->date;
 }
 
+typedef struct _branch_collation {
+    /* one gitspace branch to be collated, and what collating it produced */
+    rev_ref	**branches;	/* per-master CVS branches */
+    int		nbranch;
+    rev_ref	*branch;	/* the gitspace branch */
+    git_commit	*head;		/* its commits, published after its level */
+    git_commit	*root;		/* synthesized branch root, if any */
+    revision_t	*rootrevs;	/* the CVS commits root was built from */
+    int		nrootrevs;
+    const cvs_commit *lost;	/* unmatched branch point, reported later */
+} branch_collation;
+
+/*
+ * The CVS branches still being walked down during collation, in a heap
+ * with the newest commit on top so each changeset's leader is found
+ * without scanning every branch.  Ties go to the earlier master, which
+ * is what a linear scan would pick.  Branches whose current commit has
+ * a commitid are also chained by it so a commitid clique can be found
+ * directly.  Tailed branches are out of the walk and not in the heap.
+ */
+typedef struct _branch_heap {
+    const revision_t	*revisions;
+    int			*heap;		/* revision slots, newest on top */
+    int			*pos;		/* heap index of each slot, or -1 */
+    int			nheap;
+    int			nactive;	/* slots with older commits to come */
+    int			*match;		/* clique found by branch_heap_clique */
+    int			*stack;		/* heap indices it has yet to visit */
+    int			*idnext, *idprev; /* commitid chains, by slot */
+    int			*idbuckets;
+    int			nidbuckets;
+} branch_heap;
+
+static bool
+branch_heap_above(const branch_heap *bh, int a, int b)
+/* should slot a be nearer the top than slot b? */
+{
+    const revision_t	*revisions = bh->revisions;
+    long		t = time_compare(REVISIONS(a)->date, REVISIONS(b)->date);
+
+    return t > 0 || (t == 0 && a < b);
+}
+
+static void
+branch_heap_place(branch_heap *bh, int i, int slot)
+{
+    bh->heap[i] = slot;
+    bh->pos[slot] = i;
+}
+
+static void
+branch_heap_sift(branch_heap *bh, int i)
+/* restore heap order around index i */
+{
+    int slot = bh->heap[i], c;
+
+    while (i > 0 && branch_heap_above(bh, slot, bh->heap[(i - 1) / 2])) {
+	branch_heap_place(bh, i, bh->heap[(i - 1) / 2]);
+	i = (i - 1) / 2;
+    }
+    while ((c = 2 * i + 1) < bh->nheap) {
+	if (c + 1 < bh->nheap && branch_heap_above(bh, bh->heap[c + 1], bh->heap[c]))
+	    c++;
+	if (!branch_heap_above(bh, bh->heap[c], slot))
+	    break;
+	branch_heap_place(bh, i, bh->heap[c]);
+	i = c;
+    }
+    branch_heap_place(bh, i, slot);
+}
+
+static int *
+branch_heap_idbucket(const branch_heap *bh, const char *commitid)
+{
+    return &bh->idbuckets[HASH_VALUE(commitid) % bh->nidbuckets];
+}
+
+static void
+branch_heap_insert(branch_heap *bh, int slot)
+/* start tracking the commit now in a slot */
+{
+    const revision_t	*revisions = bh->revisions;
+    const cvs_commit	*c = REVISIONS(slot);
+
+    bh->heap[bh->nheap] = slot;
+    branch_heap_sift(bh, bh->nheap++);
+    if (c->parent || !c->dead)
+	bh->nactive++;
+    if (bh->idbuckets && c->commitid) {
+	int *bucket = branch_heap_idbucket(bh, CREF_GET(const char, c->commitid));
+	bh->idprev[slot] = -1;
+	bh->idnext[slot] = *bucket;
+	if (*bucket >= 0)
+	    bh->idprev[*bucket] = slot;
+	*bucket = slot;
+    }
+}
+
+static void
+branch_heap_remove(branch_heap *bh, int slot)
+/* stop tracking a slot; call before its commit changes */
+{
+    const revision_t	*revisions = bh->revisions;
+    const cvs_commit	*c = REVISIONS(slot);
+    int			i = bh->pos[slot];
+
+    bh->pos[slot] = -1;
+    if (i != --bh->nheap) {
+	bh->heap[i] = bh->heap[bh->nheap];
+	branch_heap_sift(bh, i);
+    }
+    if (c->parent || !c->dead)
+	bh->nactive--;
+    if (bh->idbuckets && c->commitid) {
+	if (bh->idprev[slot] >= 0)
+	    bh->idnext[bh->idprev[slot]] = bh->idnext[slot];
+	else
+	    *branch_heap_idbucket(bh, CREF_GET(const char, c->commitid)) = bh->idnext[slot];
+	if (bh->idnext[slot] >= 0)
+	    bh->idprev[bh->idnext[slot]] = bh->idprev[slot];
+    }
+}
+
+static void
+branch_heap_init(branch_heap *bh, const revision_t *revisions, int nslots)
+/* track every slot that is still live and not tailed */
+{
+    int n;
+
+    bh->revisions = revisions;
+    bh->heap = xmalloc(nslots * sizeof(int), "collation heap");
+    bh->pos = xmalloc(nslots * sizeof(int), "collation heap");
+    bh->match = xmalloc(nslots * sizeof(int), "collation heap");
+    bh->stack = xmalloc(nslots * sizeof(int), "collation heap");
+    bh->nheap = bh->nactive = 0;
+    bh->idbuckets = NULL;
+    if (trust_commitids) {
+	bh->nidbuckets = 2 * nslots + 1;
+	bh->idbuckets = xmalloc(bh->nidbuckets * sizeof(int), "collation heap");
+	bh->idnext = xmalloc(nslots * sizeof(int), "collation heap");
+	bh->idprev = xmalloc(nslots * sizeof(int), "collation heap");
+	for (n = 0; n < bh->nidbuckets; n++)
+	    bh->idbuckets[n] = -1;
+    }
+    for (n = 0; n < nslots; n++) {
+	bh->pos[n] = -1;
+	if (REVISIONS(n) && !TAILED(n))
+	    branch_heap_insert(bh, n);
+    }
+}
+
+static int
+branch_heap_clique(branch_heap *bh, const cvs_commit *latest)
+/*
+ * Collect into bh->match the slots whose commits coalesce with the
+ * leader, which must be on top of the heap.  A leader with a commitid
+ * only matches that commitid; otherwise matches must be within the
+ * time window of the leader, so only the top of the heap is searched.
+ */
+{
+    const revision_t	*revisions = bh->revisions;
+    int			nmatch = 0, nstack, i, c;
+
+    if (bh->idbuckets && latest->commitid) {
+	for (i = *branch_heap_idbucket(bh, CREF_GET(const char, latest->commitid));
+	     i >= 0; i = bh->idnext[i])
+	    if (REVISIONS(i)->commitid == latest->commitid)
+		bh->match[nmatch++] = i;
+	return nmatch;
+    }
+    /* depth-first through the heap, pruning below commits too old to match */
+    nstack = 0;
+    bh->stack[nstack++] = 0;
+    while (nstack) {
+	i = bh->stack[--nstack];
+	const cvs_commit *rev = REVISIONS(bh->heap[i]);
+	if (rev != latest && !cvs_commit_time_close(rev->date, latest->date))
+	    continue;
+	if (rev == latest || cvs_commit_match(rev, latest))
+	    bh->match[nmatch++] = bh->heap[i];
+	for (c = 2 * i + 1; c <= 2 * i + 2 && c < bh->nheap; c++)
+	    bh->stack[nstack++] = c;
+    }
+    return nmatch;
+}
+
+static void
+branch_heap_free(branch_heap *bh)
+{
+    free(bh->heap);
+    free(bh->pos);
+    free(bh->match);
+    free(bh->stack);
+    if (bh->idbuckets) {
+	free(bh->idbuckets);
+	free(bh->idnext);
+	free(bh->idprev);
+    }
+}
+
 static void
-collate_branches(rev_ref **branches, int nbranch,
-		  rev_ref *branch, git_repo *gl)
+collate_branches(branch_collation *job, const git_repo *gl)
 /* collate a set of per-CVS-master branches into a gitspace DAG branch */
 {
+    rev_ref **branches = job->branches;
+    int nbranch = job->nbranch;
+    rev_ref *branch = job->branch;
     int nlive;
     int n;
-    git_commit *prev = NULL;
-    git_commit *head = NULL, **tail = &head;
+    git_commit *prev = NULL, *root = NULL;
+    git_commit *head = NULL;
     revision_t *revisions = xmalloc(nbranch * sizeof(revision_t), "collating per-file branches");
     git_commit *commit;
     cvs_commit *latest;
-    revision_t *p;
+    branch_heap bh;
     time_t birth = 0;
 
     /*
@@ -445,7 +844,7 @@ collate_branches(rev_ref **branches, int nbranch,
 	if (!c)
 	    continue;
 	if (branches[n]->tail) {
-	    c->tailed = true;
+	    REVISION_T_SET_TAILED(revisions[n]);
 	    continue;
 	}
 	nlive++;
@@ -459,9 +858,9 @@ collate_branches(rev_ref **branches, int nbranch,
 	while (c && !c->tail) {
 	    if (!birth || time_compare(c->date, birth) < 0)
 		birth = c->date;
-	    c = c->parent;
+	    c = CREF_GET(cvs_commit, c->parent);
 	}
-	if (c && (!c->dead || c->date != c->parent->date)) {
+	if (c && (!c->dead || c->date != CREF_GET(cvs_commit, c->parent)->date)) {
 	    if (!birth || time_compare(c->date, birth) < 0)
 		birth = c->date;
 	}
@@ -478,13 +877,13 @@ collate_branches(rev_ref **branches, int nbranch,
      */
     for (n = 0; n < nbranch; n++) {
 	cvs_commit *c = REVISIONS(n);
-	if (!c->tailed)
+	if (!TAILED(n))
 	    continue;
 	if (!birth || time_compare(birth, c->date) >= 0)
 	    continue;
 	if (!c->dead) {
 	    warn("warning - %s branch %s: tip commit older than imputed branch join\n",
-		     c->master->name, branch->ref_name);
+		     CREF_GET(const rev_master, c->master)->name, branch->ref_name);
 	    continue;
 	}
 
@@ -496,27 +895,15 @@ collate_branches(rev_ref **branches, int nbranch,
      * Walk down CVS branches creating gitspace commits until each CVS
      * branch has collated with its parent.
      */
-    while (nlive > 0 && nbranch > 0) {
+    branch_heap_init(&bh, revisions, nbranch);
+    for (nlive = bh.nheap; nlive > 0; nlive = bh.nactive) {
+	int nmatch;
+
 	/*
-	 * Gather the next set of CVS commits down the branch and
-	 * figure out which (non-tailed) one of them is latest in
-	 * time.  It will be the leader for the git commit build.
+	 * The newest (non-tailed) CVS commit down the branches is
+	 * the leader for the git commit build.
 	 */
-	for (n = 0, p = revisions, latest = NULL; n < nbranch; n++) {
-	    /*
-	     * Squeeze null commit pointers out of the current set.
-	     */
-	    cvs_commit *rev = REVISIONS(n);
-	    if (!rev)
-		continue;
-	    *p++ = revisions[n];
-	    if (rev->tailed)
-		continue;
-	    if (!latest || time_compare(latest->date, rev->date) < 0)
-		latest = rev;
-	}
-	assert(latest != NULL);
-	nbranch = p - revisions;
+	latest = REVISIONS(bh.heap[0]);
 
 	/*
 	 * Construct current commit from the set of CVS commits
@@ -527,33 +914,30 @@ collate_branches(rev_ref **branches, int nbranch,
 	commit = git_commit_build(revisions, latest, nbranch);
 
 	/*
-	 * Step down each CVS branch in parallel.  Our goal is to land on
-	 * a clique of matching CVS commits that will  be made into a
-	 * matching gitspace commit on the next time around the loop.
+	 * Step down each CVS branch in the leader's clique.  Our goal is
+	 * to land on a clique of matching CVS commits that will be made
+	 * into a matching gitspace commit on the next time around the loop.
 	 */
-	nlive = 0;
-	for (n = 0; n < nbranch; n++) {
-	    cvs_commit *c = REVISIONS(n);
+	nmatch = branch_heap_clique(&bh, latest);
+	while (nmatch--) {
+	    cvs_commit *c;
 	    cvs_commit *to;
-	    /* already got to parent branch? */
-	    if (c->tailed)
-		continue;
-	    /* not affected? */
-	    if (c != latest && !cvs_commit_match(c, latest)) {
-		if (c->parent || !c->dead)
-		    nlive++;
-		continue;
-	    }
+	    bool tailed = false;
+
+	    n = bh.match[nmatch];
+	    c = REVISIONS(n);
+	    branch_heap_remove(&bh, n);
 #ifdef GITSPACEDEBUG
 	    if (c->gitspace) {
 		warn("CVS commit allocated to multiple git commits: ");
-		dump_number_file(LOGFILE, c->master->name, c->number);
+		dump_number_file(LOGFILE, CREF_GET(const rev_master, c->master)->name,
+				 CREF_GET(const cvs_number, c->number));
 		warn("\n");
 	    } else
 #endif /* GITSPACEDEBUG */
-		c->gitspace = commit;
+		CREF_SET(c->gitspace, commit);
 
-	    to = c->parent;
+	    to = CREF_GET(cvs_commit, c->parent);
 	    /*
 	     * CVS branch starts here?  If so, drop it out of
 	     * the revision set and keep going.
@@ -582,19 +966,16 @@ collate_branches(rev_ref **branches, int nbranch,
 		 * branch had forked off it but before
 		 * our branch's creation.
 		 */
-		to->tailed = true;
-	    } else if (!to->dead) {
-		nlive++;
-	    } else {
+		tailed = true;
+	    } else if (to->dead) {
 		/*
 		 * See if it's recent CVS adding a file
 		 * independently added on another branch.
 		 */
 		if (!to->parent)
 		    goto Kill;
-		if (to->tail && to->date == to->parent->date)
+		if (to->tail && to->date == CREF_GET(cvs_commit, to->parent)->date)
 		    goto Kill;
-		nlive++;
 	    }
 
 	    /*
@@ -603,16 +984,23 @@ collate_branches(rev_ref **branches, int nbranch,
 	     * changeset construction.
 	     */
 	    REVISION_T_PACK(revisions[n], to);
+	    if (tailed)
+		REVISION_T_SET_TAILED(revisions[n]);
+	    else
+		branch_heap_insert(&bh, n);
 	    continue;
 	Kill:
 	    // cppcheck-suppress nullPointer
 	    REVISION_T_PACK(revisions[n], (cvs_commit *)NULL);
 	}
 
-	*tail = commit;
-	tail = &commit->parent;
+	if (prev)
+	    CREF_SET(prev->parent, commit);
+	else
+	    head = commit;
 	prev = commit;
     }
+    branch_heap_free(&bh);
 
     /*
      * Gitspace branch construction is done. Now connect it to its
@@ -637,7 +1025,8 @@ collate_branches(rev_ref **branches, int nbranch,
 		{
 		    /* FIXME: what does this mean? */
 		    warn("file %s appears after branch %s date\n",
-			 REVISIONS(present)->master->name, branch->ref_name);
+			 CREF_GET(const rev_master, REVISIONS(present)->master)->name,
+			 branch->ref_name);
 		    continue;
 		}
 		break;
@@ -648,11 +1037,11 @@ collate_branches(rev_ref **branches, int nbranch,
 	     * Branch join looks normal, we can just go ahead and build
 	     * the last commit.
 	     */
-	    *tail = NULL;
-	else if ((*tail = git_commit_locate_one(branch->parent,
-						REVISIONS(present))))
+	    root = NULL;
+	else if ((root = git_commit_locate_one(branch->parent,
+					       REVISIONS(present))))
 	{
-	    if (prev && time_compare((*tail)->date, prev->date) > 0) {
+	    if (prev && time_compare(root->date, prev->date) > 0) {
 		cvs_commit *first;
 		warn("warning - branch point %s -> %s later than branch\n",
 			 branch->ref_name, branch->parent->ref_name);
@@ -661,8 +1050,8 @@ collate_branches(rev_ref **branches, int nbranch,
 		     DEAD(present) ? "D" : " " );
 		if (!DEAD(present))
 		    dump_number_file(LOGFILE,
-				     REVISIONS(present)->master->name,
-				     REVISIONS(present)->number);
+				     CREF_GET(const rev_master, REVISIONS(present)->master)->name,
+				     CREF_GET(const cvs_number, REVISIONS(present)->number));
 		fprintf(LOGFILE, "\n");
 		/*
 		 * The file part of the error message could be spurious for
@@ -678,51 +1067,172 @@ collate_branches(rev_ref **branches, int nbranch,
 		first = revdir_iter_next(ri);
 		free(ri);
 		dump_number_file(LOGFILE,
-				  first->master->name,
-				  first->number);
+				  CREF_GET(const rev_master, first->master)->name,
+				  CREF_GET(const cvs_number, first->number));
 		fprintf(LOGFILE, "\n");
 	    }
-	} else if ((*tail = git_commit_locate_date(branch->parent,
-						   REVISIONS(present)->date)))
+	} else if ((root = git_commit_locate_date(branch->parent,
+						  REVISIONS(present)->date)))
 	    warn("warning - branch point %s -> %s matched by date\n",
 		     branch->ref_name, branch->parent->ref_name);
-	else {
-	    rev_ref	*lost;
-	    warn("error - branch point %s -> %s not found.",
-		branch->ref_name, branch->parent->ref_name);
-
-	    if ((lost = git_branch_of_commit(gl, REVISIONS(present))))
-		warn(" Possible match on %s.", lost->ref_name);
-	    fprintf(LOGFILE, "\n");
-	}
-	if (*tail) {
+	else
+	    /*
+	     * Which other branch holds the commit depends on which
+	     * branches are collated yet, so leave the report until
+	     * they all are; collate_report_lost() makes it.
+	     */
+	    job->lost = REVISIONS(present);
+	if (root) {
 	    if (prev)
 		prev->tail = true;
 	} else {
-	    *tail = git_commit_build(revisions, REVISIONS(0), nbranch);
-	    for (n = 0; n < nbranch; n++)
-		if (REVISIONS(n)) {
+	    /*
+	     * These CVS commits may be parent-branch commits shared
+	     * with sibling branches, so their gitspace links are set
+	     * afterwards, in branch order, by collate_link_root().
+	     */
+	    root = git_commit_build(revisions, REVISIONS(0), nbranch);
+	    job->root = root;
+	    job->rootrevs = revisions;
+	    job->nrootrevs = nbranch;
+	    revisions = NULL;
+	}
+	if (prev)
+	    CREF_SET(prev->parent, root);
+	else
+	    head = root;
+    }
+
+    free(revisions);
+    job->head = head;
+}
+
+static void
+collate_link_root(branch_collation *job)
+/* point the CVS commits a synthesized branch root was built from at it */
+{
+    revision_t	*revisions = job->rootrevs;
+    int		n;
+
+    for (n = 0; n < job->nrootrevs; n++)
+	if (REVISIONS(n)) {
 #ifdef GITSPACEDEBUG
-		    if (REVISIONS(n)->gitspace) {
-			warn("CVS commit allocated to multiple git commits: ");
-			dump_number_file(LOGFILE,
-					 REVISIONS(n)->master->name,
-					 REVISIONS(n)->number);
-			warn("\n");
-		    } else
+	    if (REVISIONS(n)->gitspace) {
+		warn("CVS commit allocated to multiple git commits: ");
+		dump_number_file(LOGFILE,
+				 CREF_GET(const rev_master, REVISIONS(n)->master)->name,
+				 CREF_GET(const cvs_number, REVISIONS(n)->number));
+		warn("\n");
+	    } else
 #endif /* GITSPACEDEBUG */
-			REVISIONS(n)->gitspace = *tail;
-		}
+		CREF_SET(REVISIONS(n)->gitspace, job->root);
 	}
+    free(revisions);
+    job->rootrevs = NULL;
+}
+
+#ifdef THREADS
+static pthread_mutex_t	collate_mutex = PTHREAD_MUTEX_INITIALIZER;
+static branch_collation	**level_jobs;
+static size_t		level_count, level_next;
+
+static void *
+collate_worker(void *arg)
+/* collate branches off the current level until none are left */
+{
+    const git_repo *gl = arg;
+
+    for (;;) {
+	branch_collation *job;
+
+	TRACE_LOCK(&collate_mutex, "collate_mutex");
+	job = level_next < level_count ? level_jobs[level_next++] : NULL;
+	pthread_mutex_unlock(&collate_mutex);
+	if (!job)
+	    break;
+	revdir_pack_alloc(job->nbranch);
+	collate_branches(job, gl);
+	TRACE_LOCK(&collate_mutex, "collate_mutex");
+	progress_step();
+	pthread_mutex_unlock(&collate_mutex);
     }
+    /* the pack buffers are per-thread */
+    revdir_pack_free();
+    revdir_free_bufs();
+    gather_thread_stats();
+    return NULL;
+}
 
-    for (n = 0; n < nbranch; n++)
-	if (REVISIONS(n))
-	    REVISIONS(n)->tailed = false;
+static void
+collate_levels(branch_collation *jobs, size_t njobs, git_repo *gl)
+/*
+ * Collate branches in parallel, a dependency level at a time.
+ *
+ * Collating a branch reads nothing from other gitspace branches but
+ * its parent's finished commit chain, so every branch at one depth
+ * can be collated at once after all shallower ones are done.
+ */
+{
+    pthread_t	*workers;
+    size_t	i, nworkers;
+    int		depth, maxdepth = 0;
+
+    for (i = 0; i < njobs; i++)
+	if (jobs[i].branch->depth > maxdepth)
+	    maxdepth = jobs[i].branch->depth;
+    level_jobs = xmalloc(njobs * sizeof(branch_collation *), "collation levels");
+    workers = xmalloc(threads * sizeof(pthread_t), "collation levels");
+    for (depth = 1; depth <= maxdepth; depth++) {
+	level_count = level_next = 0;
+	for (i = 0; i < njobs; i++)
+	    if (jobs[i].branch->depth == depth)
+		level_jobs[level_count++] = &jobs[i];
+	nworkers = level_count < (size_t)threads ? level_count : (size_t)threads;
+	if (nworkers > 1) {
+	    for (i = 0; i < nworkers; i++)
+		pthread_create(&workers[i], NULL, collate_worker, gl);
+	    for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+	} else
+	    for (i = 0; i < level_count; i++) {
+		collate_branches(level_jobs[i], gl);
+		progress_step();
+	    }
+	/* children of this level may now look at its commits */
+	for (i = 0; i < level_count; i++)
+	    /* PUNNING: see the big comment in cvs.h */
+	    level_jobs[i]->branch->commit = (cvs_commit *)level_jobs[i]->head;
+    }
+    free(workers);
+    free(level_jobs);
+    level_jobs = NULL;
+}
+#endif /* THREADS */
 
-    free(revisions);
-    /* PUNNING: see the big comment in cvs.h */
-    branch->commit = (cvs_commit *)head;
+static void
+collate_report_lost(const branch_collation *job, const git_repo *gl)
+/* report a branch point not found, naming the branch that has it if any */
+{
+    rev_ref	*lost;
+
+    warn("error - branch point %s -> %s not found.",
+	 job->branch->ref_name, job->branch->parent->ref_name);
+    if ((lost = git_branch_of_commit(gl, job->lost, job->branch)))
+	warn(" Possible match on %s.", lost->ref_name);
+    fprintf(LOGFILE, "\n");
+}
+
+/* revision numbers that vendor imports make interchangeable */
+static const cvs_number *n1 = NULL;
+static const cvs_number *n2 = NULL;
+
+static void
+vendor_numbers_init(void)
+{
+    if (!n1) {
+	n1 = atom_cvs_number(lex_number("1.1"));
+	n2 = atom_cvs_number(lex_number("1.1.1.1"));
+    }
 }
 
 static bool
@@ -734,22 +1244,17 @@ git_commit_contains_revs(git_commit *g, cvs_commit **revs, size_t nrev)
     revdir_iter *it = revdir_iter_alloc(&g->revdir);
     size_t i = 0;
     cvs_commit *c = NULL;
-    static bool n_init = false;
-    static const cvs_number *n1 = NULL;
-    static const cvs_number *n2 = NULL;
 
-    if (!n_init) {
-	n1 = atom_cvs_number(lex_number("1.1"));
-	n2 = atom_cvs_number(lex_number("1.1.1.1"));
-	n_init = true;
-    }
+    vendor_numbers_init();
     /* order of checks is important */
     while ((c = revdir_iter_next(it)) && i < nrev) {
 	if (revs[i] != c) {
 	    // seen repos where 1.1 and 1.1.1.1 are used interchangeably
+	    const cvs_number *rn = CREF_GET(const cvs_number, revs[i]->number);
+	    const cvs_number *cn = CREF_GET(const cvs_number, c->number);
 	    if (revs[i]->master != c->master
-		|| (revs[i]->number != n1 && revs[i]->number != n2)
-		|| (c->number != n1 && c->number != n2)) {
+		|| (rn != n1 && rn != n2)
+		|| (cn != n1 && cn != n2)) {
 		free(it);
 		return false;
 	    }
@@ -767,8 +1272,8 @@ compare_cvs_commit(const void *a, const void *b)
 {
     cvs_commit **ap = (cvs_commit **)a;
     cvs_commit **bp = (cvs_commit **)b;
-    const char *af = (*ap)->master->name;
-    const char *bf = (*bp)->master->name;
+    const char *af = CREF_GET(const rev_master, (*ap)->master)->name;
+    const char *bf = CREF_GET(const rev_master, (*bp)->master)->name;
 
 #ifdef ORDERDEBUG
     warn("Comparing %s with %s\n", af, bf);
@@ -777,6 +1282,288 @@ compare_cvs_commit(const void *a, const void *b)
     return path_deep_compare(af, bf);
 }
 
+/*
+ * Index of gitspace commits for tag placement.  Each commit is entered
+ * under the fingerprint of its revdir, so the commits holding exactly
+ * a tag's revision set are a hash probe away.  Each also records where
+ * the branch walk in rev_tag_search() would first meet it, so we can
+ * tell which of several matches that walk would have settled on.
+ */
+typedef struct _tag_node {
+    struct _tag_node	*commit_next;	/* chain by commit */
+    struct _tag_node	*print_next;	/* chain by revdir fingerprint */
+    struct _tag_node	*children;	/* commits with us as parent */
+    struct _tag_node	*sibling;
+    git_commit		*commit;
+    long		minabove;	/* oldest date between owner tip and here */
+    int			owner;		/* first head whose walk meets us */
+    int			depth;		/* distance from that head's tip */
+    int			tip;		/* first head with us at its tip, or -1 */
+} tag_node;
+
+static tag_node	**tag_by_commit, **tag_by_print;
+static size_t	tag_index_size, tag_index_count;
+static int	tag_index_heads;
+/* masters with a vendor branch, where 1.1 and 1.1.1.1 may stand in for each other */
+static const rev_master	**vendor_masters;
+static size_t		nvendor_masters;
+
+static size_t
+tag_commit_slot(const git_commit *g)
+{
+    return HASH_VALUE(g) & (tag_index_size - 1);
+}
+
+static size_t
+tag_print_slot(const revdir *revdir)
+{
+    return revdir_hash(revdir) & (tag_index_size - 1);
+}
+
+static tag_node *
+tag_node_find(const git_commit *g)
+{
+    tag_node	*n;
+
+    if (!tag_index_size)
+	return NULL;
+    for (n = tag_by_commit[tag_commit_slot(g)]; n; n = n->commit_next)
+	if (n->commit == g)
+	    return n;
+    return NULL;
+}
+
+static tag_node *
+tag_node_add(git_commit *g, int owner, int depth, long minabove)
+/* enter a commit in the index */
+{
+    tag_node	*n, **bucket;
+
+    if (tag_index_count >= tag_index_size) {
+	/* keep the load factor at most one */
+	tag_node **old = tag_by_commit;
+	size_t	i, oldsize = tag_index_size;
+
+	tag_index_size = oldsize ? oldsize * 2 : 1024;
+	tag_by_commit = xcalloc(tag_index_size, sizeof(tag_node *), "tag index");
+	free(tag_by_print);
+	tag_by_print = xcalloc(tag_index_size, sizeof(tag_node *), "tag index");
+	for (i = 0; i < oldsize; i++)
+	    while ((n = old[i])) {
+		old[i] = n->commit_next;
+		bucket = &tag_by_commit[tag_commit_slot(n->commit)];
+		n->commit_next = *bucket;
+		*bucket = n;
+		bucket = &tag_by_print[tag_print_slot(&n->commit->revdir)];
+		n->print_next = *bucket;
+		*bucket = n;
+	    }
+	free(old);
+    }
+    n = arena_alloc(&collate_arena, sizeof(tag_node), "tag index");
+    n->commit = g;
+    n->owner = owner;
+    n->depth = depth;
+    n->minabove = minabove;
+    n->tip = -1;
+    bucket = &tag_by_commit[tag_commit_slot(g)];
+    n->commit_next = *bucket;
+    *bucket = n;
+    bucket = &tag_by_print[tag_print_slot(&g->revdir)];
+    n->print_next = *bucket;
+    *bucket = n;
+    tag_index_count++;
+    return n;
+}
+
+static void
+tag_node_link(tag_node *parent, tag_node *child)
+{
+    child->sibling = parent->children;
+    parent->children = child;
+}
+
+static void
+tag_index_head(git_commit *g, int head)
+/* walk a branch head into the index, stopping at commits already seen */
+{
+    tag_node	*n, *p;
+
+    if (!g)
+	return;
+    if ((n = tag_node_find(g))) {
+	if (n->tip < 0)
+	    n->tip = head;
+	return;
+    }
+    n = tag_node_add(g, head, 0, LONG_MAX);
+    n->tip = head;
+    while ((g = CREF_GET(git_commit, g->parent))) {
+	if ((p = tag_node_find(g))) {
+	    tag_node_link(p, n);
+	    break;
+	}
+	p = tag_node_add(g, head, n->depth + 1,
+			 n->minabove < (long)n->commit->date ?
+			 n->minabove : (long)n->commit->date);
+	tag_node_link(p, n);
+	n = p;
+    }
+}
+
+static int
+compare_pointer(const void *a, const void *b)
+{
+    uintptr_t pa = (uintptr_t)*(const void **)a;
+    uintptr_t pb = (uintptr_t)*(const void **)b;
+
+    return pa < pb ? -1 : pa > pb;
+}
+
+static void
+tag_index_build(const git_repo *gl, const cvs_master *masters, size_t nmasters)
+/* index every gitspace commit, and note which masters have vendor branches */
+{
+    const cvs_master	*cm;
+    const cvs_number	*vendor = atom_cvs_number(lex_number("1.1.1"));
+    const rev_ref	*h;
+
+    tag_index_heads = 0;
+    for (h = gl->heads; h; h = h->next, tag_index_heads++)
+	if (!h->tail)
+	    /* PUNNING: see the big comment in cvs.h */
+	    tag_index_head((git_commit *)h->commit, tag_index_heads);
+
+    vendor_numbers_init();
+    vendor_masters = xmalloc(nmasters * sizeof(rev_master *), "tag index");
+    nvendor_masters = 0;
+    for (cm = masters; cm < masters + nmasters; cm++)
+	for (h = cm->heads; h; h = h->next)
+	    if (h->commit && h->number && cvs_number_equal(h->number, vendor)) {
+		vendor_masters[nvendor_masters++] = CREF_GET(rev_master, h->commit->master);
+		break;
+	    }
+    qsort(vendor_masters, nvendor_masters, sizeof(rev_master *), compare_pointer);
+}
+
+static void
+tag_index_free(void)
+{
+    /* the nodes themselves go with collate_arena */
+    free(tag_by_commit);
+    free(tag_by_print);
+    tag_by_commit = tag_by_print = NULL;
+    tag_index_size = tag_index_count = 0;
+    free(vendor_masters);
+    vendor_masters = NULL;
+}
+
+static bool
+tag_revs_fuzzy(cvs_commit **revs, size_t nrev)
+/*
+ * Could git_commit_contains_revs() match these revisions against a
+ * commit holding different ones?  Only where 1.1 and 1.1.1.1 of a
+ * master with a vendor branch are taken for each other.
+ */
+{
+    size_t	i;
+
+    for (i = 0; i < nrev; i++) {
+	const cvs_number *number = CREF_GET(const cvs_number, revs[i]->number);
+	const rev_master *master = CREF_GET(const rev_master, revs[i]->master);
+
+	if (number == n2)
+	    return true;
+	if (number == n1 &&
+	    bsearch(&master, vendor_masters, nvendor_masters,
+		    sizeof(rev_master *), compare_pointer))
+	    return true;
+    }
+    return false;
+}
+
+static bool
+tag_walk_passes(const tag_node *n, const git_commit *stop, cvstime_t cutoff)
+/* would the rev_tag_search() walk go on past this commit? */
+{
+    return n->commit != stop && time_compare(n->commit->date, cutoff) >= 0;
+}
+
+static git_commit *
+tag_index_search(const revdir *target, const git_commit *stop)
+/*
+ * Find the commit holding exactly the target revdir that the walk in
+ * rev_tag_search() would meet first: that walk goes through the heads
+ * in order, each from its tip down to stop or to a commit older than
+ * stop, and takes the first match.  Rank a candidate by the first head
+ * meeting it and how far down; the owning head's walk, if nothing cuts
+ * it short, gives that directly, otherwise search up from the candidate
+ * for the tips that reach it.
+ */
+{
+    const cvstime_t	cutoff = stop->date;
+    const tag_node	*stop_node = tag_node_find(stop);
+    git_commit		*best = NULL;
+    int			best_head = INT_MAX, best_depth = INT_MAX;
+    tag_node		*n;
+
+    if (!tag_index_size)
+	return NULL;
+    for (n = tag_by_print[tag_print_slot(target)]; n; n = n->print_next) {
+	if (!revdir_equal(&n->commit->revdir, target) ||
+	    !tag_walk_passes(n, stop, cutoff))
+	    continue;
+	if (n->minabove >= (long)cutoff &&
+	    !(stop_node && stop_node->owner == n->owner &&
+	      stop_node->depth < n->depth)) {
+	    if (n->owner < best_head ||
+		(n->owner == best_head && n->depth < best_depth)) {
+		best = n->commit;
+		best_head = n->owner;
+		best_depth = n->depth;
+	    }
+	    continue;
+	}
+	/* cut short on the owner's walk; look for other heads reaching it */
+	{
+	    const tag_node	**stack;
+	    int			*dist, nstack = 0, d;
+	    size_t		sstack = 16;
+
+	    stack = xmalloc(sstack * sizeof(tag_node *), "tag search");
+	    dist = xmalloc(sstack * sizeof(int), "tag search");
+	    stack[nstack] = n;
+	    dist[nstack++] = 0;
+	    while (nstack) {
+		const tag_node *u = stack[--nstack];
+		const tag_node *k;
+
+		d = dist[nstack];
+		if (u->tip >= 0 && (u->tip < best_head ||
+				    (u->tip == best_head && d < best_depth))) {
+		    best = n->commit;
+		    best_head = u->tip;
+		    best_depth = d;
+		}
+		for (k = u->children; k; k = k->sibling) {
+		    if (!tag_walk_passes(k, stop, cutoff))
+			continue;
+		    if ((size_t)nstack == sstack) {
+			sstack *= 2;
+			stack = xrealloc(stack, sstack * sizeof(tag_node *), "tag search");
+			dist = xrealloc(dist, sstack * sizeof(int), "tag search");
+		    }
+		    stack[nstack] = k;
+		    dist[nstack++] = d + 1;
+		}
+	    }
+	    free(stack);
+	    free(dist);
+	}
+    }
+    return best;
+}
+
 /*
  * Locate position in git tree corresponding to specific tag
  */
@@ -812,20 +1599,47 @@ rev_tag_search(tag_t *tag, cvs_commit **revisions, git_repo *gl)
     cvs_commit *c = cvs_commit_latest(revisions, tag->count);
     if (!c)	/* only dead revisions in the tag */
 	return;
-    if (c->gitspace == NULL) {
+    if (!c->gitspace) {
 	char buf[CVS_MAX_REV_LEN + 1];
 	warn("%s %s: %s points at commit with no gitspace link.\n",
-	     c->master->name,
-	     cvs_number_string(c->number, buf, sizeof(buf)),
+	     CREF_GET(const rev_master, c->master)->name,
+	     cvs_number_string(CREF_GET(const cvs_number, c->number), buf, sizeof(buf)),
 	     tag->name);
 	return;
     }
 
     qsort(revisions, tag->count, sizeof(cvs_commit *), compare_cvs_commit);
-    if (git_commit_contains_revs(c->gitspace, revisions, tag->count)) {
+    if (git_commit_contains_revs(CREF_GET(git_commit, c->gitspace),
+				 revisions, tag->count)) {
 	/* we've seen this set of revisions before, just link tag to it */
-	tag->commit = c->gitspace;
+	tag->commit = CREF_GET(git_commit, c->gitspace);
 	return;
+    } else if (!tag_revs_fuzzy(revisions, tag->count)) {
+	/*
+	 * With no 1.1/1.1.1.1 stand-ins possible, only a commit
+	 * holding exactly these revisions can match, and packing them
+	 * gives us its revdir to look up.  A dead revision can't be in
+	 * any commit at all.
+	 */
+	revdir	target;
+	size_t	i;
+
+	for (i = 0; i < tag->count; i++)
+	    if (revisions[i]->dead)
+		break;
+	if (i == tag->count) {
+	    git_commit *g;
+
+	    revdir_pack_init();
+	    for (i = 0; i < tag->count; i++)
+		revdir_pack_add(revisions[i],
+				CREF_GET(const rev_master, revisions[i]->master)->dir);
+	    revdir_pack_end(&target);
+	    if ((g = tag_index_search(&target, CREF_GET(git_commit, c->gitspace)))) {
+		tag->commit = g;
+		return;
+	    }
+	}
     } else {
 	/* Search to try and find a matching git commit.
 	 * We can prune if we get to c->gitspace.
@@ -849,10 +1663,10 @@ rev_tag_search(tag_t *tag, cvs_commit **revisions, git_repo *gl)
 	    if (h->tail)
 		continue;
 	    /* PUNNING: See large comment in cvs.h */
-	    for (g = (git_commit *)h->commit; g; g = g->parent) {
-		if (g == c->gitspace)
+	    for (g = (git_commit *)h->commit; g; g = CREF_GET(git_commit, g->parent)) {
+		if (g == CREF_GET(git_commit, c->gitspace))
 		    break;
-		if (time_compare(g->date, c->gitspace->date) < 0)
+		if (time_compare(g->date, CREF_GET(git_commit, c->gitspace)->date) < 0)
 		    break;
 		if (git_commit_contains_revs(g, revisions, tag->count)) {
 		    tag->commit = g;
@@ -879,8 +1693,8 @@ rev_tag_search(tag_t *tag, cvs_commit **revisions, git_repo *gl)
     git_commit *g = git_commit_build(revs, c, tag->count);
     free(revs);
     g->parent = c->gitspace;
-    rev_ref *parent_branch = git_branch_of_commit(gl, c);
-    rev_ref *tag_branch = xcalloc(1, sizeof(rev_ref), __func__);
+    rev_ref *parent_branch = git_branch_of_commit(gl, c, NULL);
+    rev_ref *tag_branch = gitspace_alloc(sizeof(rev_ref), __func__);
     tag_branch->parent = parent_branch;
     /* type punning */
     tag_branch->commit = (cvs_commit *)g;
@@ -891,35 +1705,43 @@ rev_tag_search(tag_t *tag, cvs_commit **revisions, git_repo *gl)
     for (r = gl->heads; r->next; r = r->next)
 	continue;
     r->next = tag_branch;
-    g->author = atom("cvs-fast-export");
+    /* later tags may match this commit too */
+    {
+	tag_node *n = tag_node_add(g, tag_index_heads, 0, LONG_MAX);
+	tag_node *p = tag_node_find(CREF_GET(git_commit, c->gitspace));
+
+	n->tip = tag_index_heads++;
+	if (p)
+	    tag_node_link(p, n);
+    }
+    CREF_SET(g->author, atom("cvs-fast-export"));
     size_t len = strlen(tag->name) + 42;
     char *log = xmalloc(len, __func__);
     snprintf(log, len, "Synthetic commit for incomplete tag %s\n", tag->name);
-    g->log = atom(log);
+    CREF_SET(g->log, log_intern(log));
     free(log);
 }
 
 static void
-rev_ref_set_parent(git_repo *gl, rev_ref *dest, cvs_master *source, size_t nmasters)
+rev_ref_set_parent(rev_ref *dest)
 /* compute parent relationships among gitspace branches */
 {
-    cvs_master	*s;
-    rev_ref	*p, *max;
+    branch_clique	*b;
+    rev_ref		*p, *max;
+    size_t		i;
 
     if (dest->depth)
 	return;
 
     max = NULL;
-    for (s = source; s < source + nmasters; s++) {
-	rev_ref	*sh;
-	sh = rev_find_head(s, dest->ref_name);
-	if (!sh)
-	    continue;
+    b = branch_clique_find(dest->ref_name);
+    for (i = 0; b && i < b->nrefs; i++) {
+	rev_ref	*sh = b->refs[i];
 	if (!sh->parent)
 	    continue;
-	p = rev_find_head((head_list*)gl, sh->parent->ref_name);
+	p = branch_clique_find(sh->parent->ref_name)->head;
 	assert(p);
-	rev_ref_set_parent(gl, p, source, nmasters);
+	rev_ref_set_parent(p);
 	if (!max || p->depth > max->depth)
 	    max = p;
     }
@@ -934,13 +1756,14 @@ git_repo *
 collate_to_changesets(cvs_master *masters, size_t nmasters, int verbose)
 /* entry point - collate CVS revision lists to a gitspace DAG */
 {
-    size_t	head_count = 0;
+    size_t	head_count = 0, i;
     int		n; /* used only in progress messages */
-    git_repo	*gl = xcalloc(1, sizeof(git_repo), "list collate");
+    git_repo	*gl = gitspace_alloc(sizeof(git_repo), "list collate");
+    rev_ref	**tail = &gl->heads;
     cvs_master	*cm;
     rev_ref	*lh, *h;
     tag_t	*t;
-    rev_ref	**refs = xcalloc(nmasters, sizeof(rev_ref *), "list collate");
+    branch_collation *jobs;
 
     /*
      * It is expected that the branch trees in all CVS masters have
@@ -954,18 +1777,23 @@ collate_to_changesets(cvs_master *masters, size_t nmasters, int verbose)
      *
      * First, find all of the named heads across all of the incoming
      * CVS trees.  Use them to initialize named branch heads in the
-     * output list.  Yes, this is currently very inefficient.
+     * output list, indexing them by name as we go.
      */
     progress_begin("Make DAG branch heads...", nmasters);
     n = 0;
     for (cm = masters; cm < masters + nmasters; cm++) {
 	for (lh = cm->heads; lh; lh = lh->next) {
-	    h = rev_find_head((head_list *)gl, lh->ref_name);
-	    if (!h) {
+	    branch_clique *b = branch_clique_add(cm, lh);
+	    if (!b->head) {
 		head_count++;
-		rev_list_add_head((head_list *)gl, NULL, lh->ref_name, lh->degree);
-	    } else if (lh->degree > h->degree)
-		h->degree = lh->degree;
+		/* like rev_list_add_head(), without walking the list */
+		b->head = *tail = gitspace_alloc(sizeof(rev_ref),
+						 "adding head reference");
+		b->head->ref_name = lh->ref_name;
+		b->head->degree = lh->degree;
+		tail = &b->head->next;
+	    } else if (lh->degree > b->head->degree)
+		b->head->degree = lh->degree;
 	}
 	if (++n % 100 == 0)
 	    progress_jump(n);
@@ -978,10 +1806,10 @@ collate_to_changesets(cvs_master *masters, size_t nmasters, int verbose)
      * before children, with trunk first.
      */
     progress_begin("Sorting...", head_count);
-    gl->heads = rev_ref_tsort(gl->heads, masters, nmasters);
+    gl->heads = rev_ref_tsort(gl->heads, head_count);
     if (!gl->heads) {
-	free(refs);
-	/* coverity[leaked_storage] */
+	branch_clique_free();
+	arena_free(&collate_arena);
 	return NULL;
     }
     progress_end(NULL);
@@ -1001,10 +1829,11 @@ collate_to_changesets(cvs_master *masters, size_t nmasters, int verbose)
      */
     progress_begin("Compute branch parent relationships...", head_count);
     for (h = gl->heads; h; h = h->next) {
-	rev_ref_set_parent(gl, h, masters, nmasters);
+	rev_ref_set_parent(h);
 	progress_step();
     }
     progress_end(NULL);
+    gather_stats("after branch heads");
 
 #ifdef ORDERDEBUG
     fputs("collate_to_changesets: before common branch collate:\n", stderr);
@@ -1014,7 +1843,8 @@ collate_to_changesets(cvs_master *masters, size_t nmasters, int verbose)
 	    fputs("rev_ref: ", stderr);
 	    dump_number_file(stderr, lh->ref_name, lh->number);
 	    fputc('\n', stderr);
-	    fprintf(stderr, "commit first file: %s\n", commit->master->name);
+	    fprintf(stderr, "commit first file: %s\n",
+		    CREF_GET(const rev_master, commit->master)->name);
 	}
     }
 #endif /* ORDERDEBUG */
@@ -1025,28 +1855,42 @@ collate_to_changesets(cvs_master *masters, size_t nmasters, int verbose)
 
     progress_begin("Collate common branches...", head_count);
     revdir_pack_alloc(nmasters);
-    for (h = gl->heads; h; h = h->next) {
+    jobs = xcalloc(head_count, sizeof(branch_collation), "list collate");
+    for (h = gl->heads, i = 0; h; h = h->next, i++) {
 	/*
 	 * For this imputed gitspace branch, locate the corresponding
 	 * set of CVS branches from every master.
 	 */
-	int nref = 0;
-	for (cm = masters; cm < masters + nmasters; cm++) {
-	    lh = rev_find_head(cm, h->ref_name);
-	    if (lh) {
-		refs[nref++] = lh;
-	    }
+	branch_clique *b = branch_clique_find(h->ref_name);
+	jobs[i].branch = h;
+	jobs[i].branches = b->refs;
+	jobs[i].nbranch = (int)b->nrefs;
+    }
+    /*
+     * Collate each set into a single gitspace branch and add that
+     * to the output revlist on gl.
+     */
+#ifdef THREADS
+    if (threads > 1)
+	collate_levels(jobs, head_count, gl);
+    else
+#endif /* THREADS */
+	for (i = 0; i < head_count; i++) {
+	    collate_branches(&jobs[i], gl);
+	    /* PUNNING: see the big comment in cvs.h */
+	    jobs[i].branch->commit = (cvs_commit *)jobs[i].head;
+	    progress_step();
 	}
-	if (nref)
-	    /*
-	     * Collate those branches into a single gitspace branch
-	     * and add that to the output revlist on gl.
-	     */
-	    collate_branches(refs, nref, h, gl);
-	progress_step();
+    for (i = 0; i < head_count; i++) {
+	if (jobs[i].rootrevs)
+	    collate_link_root(&jobs[i]);
+	if (jobs[i].lost)
+	    collate_report_lost(&jobs[i], gl);
     }
+    free(jobs);
     progress_end(NULL);
-
+    branch_clique_free();
+    gather_stats("after branch collation");
 
 #ifdef GITSPACEDEBUG
     /* Check every non-dead cvs commit has a backlink
@@ -1057,16 +1901,18 @@ collate_to_changesets(cvs_master *masters, size_t nmasters, int verbose)
     for (cm = masters; cm < masters + nmasters; cm++) {
 	for (lh = cm->heads; lh; lh = lh->next) {
 	    cvs_commit *c = lh->commit;
-	    for (; c; c = c->parent) {
+	    for (; c; c = CREF_GET(cvs_commit, c->parent)) {
 		if (!c->gitspace) {
 		    if (!c->dead) {
 			fprintf(LOGFILE, "No gitspace: ");
-			dump_number_file(LOGFILE, c->master->name, c->number);
+			dump_number_file(LOGFILE, CREF_GET(const rev_master, c->master)->name,
+					 CREF_GET(const cvs_number, c->number));
 			fprintf(LOGFILE, "\n");
 		    }
-		} else if (!cvs_commit_match(c, (cvs_commit *)c->gitspace)) {
+		} else if (!cvs_commit_match(c, (cvs_commit *)CREF_GET(git_commit, c->gitspace))) {
 		    fprintf(LOGFILE, "Gitspace doesn't match cvs: ");
-		    dump_number_file(LOGFILE, c->master->name, c->number);
+		    dump_number_file(LOGFILE, CREF_GET(const rev_master, c->master)->name,
+				     CREF_GET(const cvs_number, c->number));
 		    fprintf(LOGFILE, "\n");
 		}
 	    }
@@ -1080,6 +1926,7 @@ collate_to_changesets(cvs_master *masters, size_t nmasters, int verbose)
      * with the right gitspace commit.
      */
     progress_begin("Find tag locations...", tag_count);
+    tag_index_build(gl, masters, nmasters);
     for (t = all_tags; t; t = t->next) {
 	cvs_commit **commits = tagged(t);
 	if (commits)
@@ -1089,9 +1936,12 @@ collate_to_changesets(cvs_master *masters, size_t nmasters, int verbose)
 	free(commits);
 	progress_step();
     }
+    tag_index_free();
+    arena_free(&collate_arena);
     revdir_pack_free();
     revdir_free_bufs();
     progress_end(NULL);
+    gather_stats("after tag location");
 
     /*
      * Compute 'tail' values.  These allow us to recognize branch joins
@@ -1102,14 +1952,10 @@ collate_to_changesets(cvs_master *masters, size_t nmasters, int verbose)
     rev_list_set_tail((head_list *)gl);
     progress_end(NULL);
 
-    free(refs);
-
     //progress_begin("Validate...", NO_MAX);
     //rev_list_validate(gl);
     //progress_end(NULL);
 
-    git_commit_cleanup();
-
     return gl;
 }
 
@@ -1127,7 +1973,7 @@ rev_uniq_file(git_commit *uniq, git_commit const *common, int *nuniqp)
 	return NULL;
     revdir_iter *ri = revdir_iter_alloc(&uniq->revdir);
     while ((c = revdir_iter_next(ri))) {
-	if (c->gitspace != common) {
+	if (CREF_GET(git_commit, c->gitspace) != common) {
 	    fl = xcalloc(1, sizeof(cvs_commit_list), "rev_uniq_file");
 	    fl->file = c;
 	    *tail = fl;
@@ -22,6 +22,9 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <limits.h>
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
 #include "cvstypes.h"
 /* 
  * CVS_MAX_BRANCHWIDTH should match the number in the longrev test.
@@ -194,13 +197,17 @@ typedef struct _editbuffer {
 #define Ginbuf(eb) (&eb->in_buffer_store)
 
 typedef struct _generator {
-    /* isolare parts of a CVS file context required for snapshot generation */
+    /*
+     * isolate parts of a CVS file context required for snapshot generation;
+     * one is retained per master until export, so it stays small and the
+     * edit buffer lives on generate_files()'s stack instead
+     */
     const char		*master_name;
     enum expand_mode    expand;
     cvs_version		*versions;
     cvs_patch		*patches;
-    nodehash_t		nodehash;
-    editbuffer_t	editbuffer;
+    node_t		*head_node;	/* root of the delta tree */
+    node_t		*nodes;		/* all nodes, chained through hash_next */
 } generator_t;
 
 typedef struct {
@@ -212,12 +219,14 @@ typedef struct {
 #endif /* REDBLACK */
     const char		*description;
     generator_t		gen;
+    nodehash_t		nodehash;	/* only while parsing and digesting */
     const cvs_number	*head;
     const cvs_number	*branch;
     cvstime_t           skew_vulnerable;
     serial_t		nversions;
     mode_t		mode;
     unsigned short	verbose;
+    bool		metadata_only;	/* don't locate delta text */
 } cvs_file;
 
 typedef struct _master_dir {
@@ -294,12 +303,38 @@ typedef struct _revdir {
  * bad things will happen.
  */
 
+/*
+ * With COMPACT_REFS the links in cvs_commit and git_commit are 32-bit
+ * references into a single reserved heap rather than pointers, which
+ * takes about a third off the size of each record.  Everything such a
+ * link can point at - commit slabs, git commits, masters, directories,
+ * string and number atoms - is allocated with compact_alloc().  Read
+ * links with CREF_GET() and write them with CREF_SET(); without
+ * COMPACT_REFS both are plain member accesses.
+ */
+#ifdef COMPACT_REFS
+typedef uint32_t	cref_t;
+/* references count 8-byte units, so the heap can grow to 32GB */
+#define COMPACT_SHIFT	3
+extern char		*compact_base;
+#define CREF(type)	cref_t
+/* branch-free: a zero reference masks the base away, giving NULL */
+#define CREF_GET(type, r)	\
+	((type *)(((uintptr_t)compact_base & -(uintptr_t)!!(r)) + \
+		  ((uintptr_t)(r) << COMPACT_SHIFT)))
+#define CREF_SET(r, p)	((r) = compact_ref(p))
+#else
+#define CREF(type)	type *
+#define CREF_GET(type, r)	(r)
+#define CREF_SET(r, p)	((r) = (p))
+#endif /* COMPACT_REFS */
+
 typedef struct _cvs_commit {
     /* a CVS revision */
-    struct _cvs_commit	*parent;
-    const char		*restrict log;
-    const char		*restrict author;
-    const char	        *restrict commitid;
+    CREF(struct _cvs_commit)	parent;
+    CREF(const char)	log;
+    CREF(const char)	author;
+    CREF(const char)	commitid;
     cvstime_t		date;
     serial_t            serial;
     branchcount_t	refcount;
@@ -308,22 +343,23 @@ typedef struct _cvs_commit {
     unsigned		dead:1;
     /* CVS-only members begin here */
     bool                emitted:1;
+    bool                wanted:1;	/* shipped by an incremental dump */
     hash_t              hash;
     /* Shortcut to master->dir, more space but less dereferences
      * in the hottest inner loop in revdir
      */
-    const master_dir    *dir;
-    const rev_master    *master;
-    struct _git_commit	*gitspace;
-    const cvs_number	*number;
+    CREF(const master_dir)	dir;
+    CREF(const rev_master)	master;
+    CREF(struct _git_commit)	gitspace;
+    CREF(const cvs_number)	number;
 } cvs_commit;
 
 typedef struct _git_commit {
     /* a gitspace changeset */
-    struct _git_commit	*parent;
-    const char		*restrict log;
-    const char		*restrict author;
-    const char		*restrict commitid;
+    CREF(struct _git_commit)	parent;
+    CREF(const char)	log;
+    CREF(const char)	author;
+    CREF(const char)	commitid;
     cvstime_t		date;
     serial_t            serial;
     branchcount_t	refcount;
@@ -387,12 +423,16 @@ typedef struct _rev_diff {
     int			nadd;
 } rev_diff;
 
+/* a timezone resolved to its UTC offsets over the span of CVS dates */
+typedef struct _tz_table tz_table;
+
 typedef struct _cvs_author {
     struct _cvs_author	*next;
     const char		*name;
     const char		*full;
     const char		*email;
     const char		*timezone;
+    const tz_table	*zone;		/* timezone, compiled */
 } cvs_author;
 
 /*
@@ -444,6 +484,13 @@ cvs_author *fullname(const char *);
 
 bool load_author_map(const char *);
 
+const tz_table *tz_compile(const char *name);
+
+int tz_offset(const tz_table *zone, const time_t t);
+
+time_t
+utc_time(const struct tm *tm);
+
 char *
 cvstime2rfc3339(const cvstime_t date);
 
@@ -456,12 +503,18 @@ lex_date(const cvs_number *n, void *, cvs_file *cvs);
 void
 atom_dir_init(void);
 
+void
+dir_hash_stats(FILE *fp);
+
 cvs_commit *
 cvs_master_digest(cvs_file *cvs, cvs_master *cm, rev_master *master);
 
 git_repo *
 collate_to_changesets(cvs_master *masters, size_t nmasters, int verbose);
 
+void
+collate_free(void);
+
 enum { Ncommits = 256 };
 
 typedef struct _chunk {
@@ -499,18 +552,40 @@ extern const master_dir *root_dir;
 
 void tag_commit(cvs_commit *c, const char *name, cvs_file *cvsfile);
 cvs_commit **tagged(tag_t *tag);
+void tag_hash_stats(FILE *fp);
 void discard_tags(void);
 
 typedef struct _import_options {
     bool promiscuous;
     int verbose;
     ssize_t striplen;
+    const char *statedir;
+    const char *save_forest;
+    const char *load_forest;
+    FILE *profile_masters;	/* opened at option time, closed by the report */
+    bool authorlist;		/* collect committer IDs for -a */
+    bool metadata_only;		/* no delta text or generators, for -g and -a */
+    bool spill;			/* hold generators on disk until export */
 } import_options_t;
 
+/* per-master costs, gathered only under --profile-masters */
+typedef struct _master_profile {
+    const char	*name;
+    double	parse_time;	/* seconds in rev_list_file() */
+    double	generate_time;	/* seconds in generate_files() */
+    serial_t	revisions;
+    unsigned	branches, symbols;
+    double	snapsize;	/* bytes of snapshot text generated */
+    size_t	peak_lines;	/* most lines in the edit buffer at once */
+} master_profile;
+
+extern master_profile *master_profiles;
+
 typedef struct _export_options {
     struct timespec start_time;
     char *branch_prefix; 
     time_t fromtime;
+    serial_t basemark;
     FILE *revision_map;
     bool reposurgeon;
     bool embed_ids;
@@ -521,12 +596,28 @@ typedef struct _export_options {
 
 typedef struct _export_stats {
     long	export_total_commits;
+    long	export_blobs;
     double	snapsize;
+    double	spoolsize;	/* blob bytes written to the spool */
+    serial_t	last_mark;
+    time_t	last_date;
 } export_stats_t;
 
 void
 analyze_masters(int argc, const char *argv[0], import_options_t *options, forest_t *forest);
 
+void
+profile_masters_report(FILE *fp);
+
+/* room for every gather_stats() call a run makes; also bounds MEMSTATS phases */
+#define MAX_CHECKPOINTS	16
+
+void
+gather_stats(const char *legend);
+
+void
+gather_thread_stats(void);
+
 enum expand_mode expand_override(char const *s);
 
 bool
@@ -614,9 +705,30 @@ atom_cvs_number(const cvs_number n);
 unsigned long
 hash_cvs_number(const cvs_number *const key);
 
+void
+atom_hash_stats(FILE *fp);
+
 void
 discard_atoms(void);
 
+/* log messages are handles; only log_text() may read them as strings */
+#ifdef LOGSTORE
+const char *
+log_intern(const char *text);
+
+const char *
+log_text(const char *log);
+#else
+#define log_intern(text)	atom(text)
+#define log_text(log)		(log)
+#endif /* LOGSTORE */
+
+void
+log_store_stats(FILE *fp);
+
+void
+log_store_free(void);
+
 rev_ref *
 rev_list_add_head(head_list *rl, cvs_commit *commit, const char *name, int degree);
 
@@ -643,12 +755,73 @@ export_commits(forest_t *forest, export_options_t *opts, export_stats_t *stats);
 void
 export_authors(forest_t *forest, export_options_t *opts);
 
+void
+state_begin(const char *dir, const size_t nmasters);
+
+bool
+state_fetch(const size_t i, const struct stat *sb, cvs_file *cvs);
+
+void
+state_store(const size_t i, const struct stat *sb, const cvs_file *cvs);
+
+void
+state_end(void);
+
+void
+state_hash_stats(FILE *fp);
+
+void
+forest_image_save(const char *path, const forest_t *forest);
+
+size_t
+forest_image_open(const char *path, forest_t *forest);
+
+void
+forest_image_master(const size_t i, const char **name, const char **export_name);
+
+void
+forest_image_fetch(const size_t i, cvs_file *cvs);
+
+void
+forest_image_close(void);
+
+void
+spill_begin(const size_t nmasters);
+
+void
+spill_store(const size_t i, generator_t *gen, const rev_master *master);
+
+void
+spill_fetch(const size_t i, generator_t *gen);
+
+void
+spill_end(void);
+
+void
+state_load_export(const char *dir, export_options_t *opts);
+
+void
+state_save_export(const char *dir, const export_stats_t *stats);
+
+void
+author_hash_stats(FILE *fp);
+
+void
+author_collect(const cvs_master *cm);
+
+const char **
+author_list(size_t *count);
+
+void
+author_seen_stats(FILE *fp);
+
 void
 free_author_map(void);
 
 void
 generate_files(generator_t *gen, export_options_t *opts,
-	       void (*hook)(node_t *node, void *buf, size_t len, export_options_t *popts));
+	       void (*hook)(node_t *node, void *buf, size_t len, export_options_t *popts),
+	       master_profile *profile);
 
 /* xnew(T) allocates aligned (packed) storage. It never returns NULL */
 #define xnew(T, legend) \
@@ -676,6 +849,51 @@ xcalloc(size_t, size_t, char const *legend) _alloclike2(1,2) _malloclike;
 void* 
 xrealloc(void *ptr, size_t size, char const *legend) _alloclike(2);
 
+/* zero-filled storage that CREF links may point at */
+#ifdef COMPACT_REFS
+void*
+compact_alloc(size_t size, char const *legend) _alloclike(1) _malloclike;
+
+cref_t
+compact_ref(const void *ptr);
+#else
+#define compact_alloc(size, legend)	xcalloc(1, size, legend)
+#endif /* COMPACT_REFS */
+
+/*
+ * An arena hands out zero-filled storage from large blocks and releases
+ * it all at once.  It does no locking of its own.
+ */
+typedef struct _arena {
+    struct _arena_block	*blocks;
+} arena_t;
+
+void*
+arena_alloc(arena_t *arena, size_t size, char const *legend) _alloclike(2) _malloclike;
+
+void
+arena_free(arena_t *arena);
+
+/*
+ * With MEMSTATS every allocation is charged to its legend, so
+ * frees have to be seen too.  Storage that did not come from the
+ * x*alloc family passes through xfree() untouched.
+ */
+#ifdef MEMSTATS
+void
+xfree(void *ptr);
+#define free(ptr)	xfree(ptr)
+
+void
+memstats_checkpoint(const char *phase);
+
+void
+memstats_report(FILE *fp);
+#else
+#define memstats_checkpoint(phase)	do {} while (0)
+#define memstats_report(fp)		do {} while (0)
+#endif /* MEMSTATS */
+
 void
 announce(char const *format,...) _printflike(1, 2);
 
@@ -697,7 +915,9 @@ fatal_system_error(char const *format, ...) _printflike(1, 2) _noreturn;
 void hash_version(nodehash_t *, cvs_version *);
 void hash_patch(nodehash_t *, cvs_patch *);
 void hash_branch(nodehash_t *, cvs_branch *);
-void clean_hash(nodehash_t *);
+void hash_commits(nodehash_t *, cvs_commit *, const serial_t);
+node_t *unhash_nodes(nodehash_t *);
+void free_nodes(node_t *);
 void build_branches(nodehash_t *);
 
 void progress_begin(const char * /*msg*/, const int /*max*/);
@@ -705,6 +925,19 @@ void progress_step(void);
 void progress_jump(const int /*count*/);
 void progress_end(const char * /*format*/, ...) _printflike(1, 2);
 
+extern bool tracing;
+void trace_begin(const char * /*path*/);
+void trace_end(void);
+void trace_span(const char * /*name*/, const char * /*category*/,
+		const struct timespec * /*begin*/, const struct timespec * /*end*/);
+void trace_phase(const char * /*name*/);
+#ifdef THREADS
+void trace_mutex_lock(pthread_mutex_t * /*mutex*/, const char * /*name*/);
+/* lock a mutex, showing long waits on the trace timeline */
+#define TRACE_LOCK(mutex, name) \
+	(tracing ? trace_mutex_lock(mutex, name) : (void)pthread_mutex_lock(mutex))
+#endif /* THREADS */
+
 #define NANOSCALE		1000000000.0
 #define nanosec(ts)		((ts)->tv_nsec + NANOSCALE * (ts)->tv_sec) 
 #define seconds_diff(a, b)	((nanosec(a) - nanosec(b)) / NANOSCALE)
@@ -38,7 +38,11 @@ typedef uint32_t	serial_t;
 typedef uint16_t		branchcount_t;
 #define MAX_BRANCHCOUNT_T	UINT16_MAX
 
-/* Hash values */
+/* Hash values; 64 bits make full-hash collisions vanishingly rare */
+#ifdef HASH64
+typedef uint64_t        hash_t;
+#else
 typedef uint32_t        hash_t;
+#endif /* HASH64 */
 
 #endif /* _CVSTYPES_H_ */
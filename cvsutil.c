@@ -65,7 +65,7 @@ generator_free(generator_t *gen)
 {
     cvs_version_free(gen->versions);
     cvs_patch_free(gen->patches);
-    clean_hash(&gen->nodehash);
+    free_nodes(gen->nodes);
 }
 
 void
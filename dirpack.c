@@ -19,6 +19,13 @@ typedef struct _file_list_hash {
 } file_list_hash;
 
 static file_list_hash	*buckets[REV_DIR_HASH];
+#ifdef THREADS
+static pthread_mutex_t	bucket_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* streaming pack state is per thread so branches can collate in parallel */
+#define PACK_LOCAL	__thread
+#else
+#define PACK_LOCAL
+#endif /* THREADS */
 
 static hash_t
 hash_files(const cvs_commit *const * const files, const int nfiles)
@@ -38,29 +45,46 @@ pack_file_list(const cvs_commit * const * const files, const int nfiles)
 /* pack a collection of file revisions for space efficiency */
 {
     hash_t         hash = hash_files(files, nfiles);
-    file_list_hash **bucket = &buckets[hash % REV_DIR_HASH];
+    file_list_hash **head = &buckets[hash % REV_DIR_HASH];
     file_list_hash *h;
 
     /* avoid packing a file list if we've done it before */ 
-    for (h = *bucket; h; h = h->next) {
+    while ((h = *head)) {
+    collision:
 	if (h->hash == hash && h->fl.nfiles == nfiles &&
 	    !memcmp(files, h->fl.files, nfiles * sizeof(cvs_commit *)))
 	{
 	    return &h->fl;
 	}
+	head = &h->next;
+    }
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_lock(&bucket_mutex);
+#endif /* THREADS */
+    if ((h = *head)) {
+#ifdef THREADS
+	if (threads > 1)
+	    pthread_mutex_unlock(&bucket_mutex);
+#endif /* THREADS */
+	goto collision;
     }
     h = xmalloc(sizeof(file_list_hash) + nfiles * sizeof(cvs_commit *),
 		 __func__);
-    h->next = *bucket;
-    *bucket = h;
+    h->next = NULL;
     h->hash = hash;
     h->fl.nfiles = nfiles;
     memcpy(h->fl.files, files, nfiles * sizeof(cvs_commit *));
+    *head = h;
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_unlock(&bucket_mutex);
+#endif /* THREADS */
     return &h->fl;
 }
 
-static size_t    sdirs = 0;
-static file_list **dirs = NULL;
+static PACK_LOCAL size_t    sdirs = 0;
+static PACK_LOCAL file_list **dirs = NULL;
 
 static void
 fl_put(const size_t index, file_list *fl)
@@ -78,6 +102,27 @@ fl_put(const size_t index, file_list *fl)
     dirs[index] = fl;
 }
 
+void
+revdir_hash_stats(FILE *fp)
+{
+    hash_stats	lists = {.name = "file lists", .hashed = true};
+    size_t	i;
+
+    for (i = 0; i < REV_DIR_HASH; i++) {
+	const file_list_hash *h, *c;
+	size_t length = 0;
+
+	for (h = buckets[i]; h; h = h->next, length++)
+	    for (c = buckets[i]; c != h; c = c->next)
+		if (c->hash == h->hash) {
+		    lists.collisions++;
+		    break;
+		}
+	hash_stats_chain(&lists, length);
+    }
+    hash_stats_report(fp, &lists);
+}
+
 void
 revdir_free(void)
 {
@@ -174,12 +219,31 @@ revdir_nfiles(const revdir *revdir)
     return c;
 }
 
-static serial_t         nfiles = 0;
-static serial_t         sfiles = 0;
-static const cvs_commit **files = NULL;
-static const master_dir *dir;
-static const master_dir *curdir;
-static unsigned short   ndirs;
+hash_t
+revdir_hash(const revdir *revdir)
+{
+    HASH_INIT(h);
+    unsigned short i;
+
+    for (i = 0; i < revdir->ndirs; i++)
+	HASH_MIX(h, revdir->dirs[i]);
+    return h;
+}
+
+bool
+revdir_equal(const revdir *a, const revdir *b)
+/* file lists are interned, so compare the list pointers */
+{
+    return a->ndirs == b->ndirs &&
+	!memcmp(a->dirs, b->dirs, a->ndirs * sizeof(file_list *));
+}
+
+static PACK_LOCAL serial_t         nfiles = 0;
+static PACK_LOCAL serial_t         sfiles = 0;
+static PACK_LOCAL const cvs_commit **files = NULL;
+static PACK_LOCAL const master_dir *dir;
+static PACK_LOCAL const master_dir *curdir;
+static PACK_LOCAL unsigned short   ndirs;
 
 void
 revdir_pack_alloc(const size_t max_size)
@@ -38,7 +38,8 @@ dump_git_commit(const git_commit *c, FILE *fp)
     cvs_commit	*cc;
     revdir_iter *it = revdir_iter_alloc(&c->revdir);
     while((cc = revdir_iter_next(it))) {
-	dump_number_file(fp, cc->master->name, cc->number);
+	dump_number_file(fp, CREF_GET(const rev_master, cc->master)->name,
+			 CREF_GET(const cvs_number, cc->number));
 	printf(" ");
     }
     fputs("\n", fp);
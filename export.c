@@ -174,6 +174,16 @@ static void export_blob(node_t *node,
 			export_options_t *opts)
 /* output the blob, or save where it will be available for random access */
 {
+    /*
+     * When incremental-dumping, generate_files() passes a null buffer
+     * for revisions no reported commit ships (see mark_wanted()).
+     * They still need a serial, but not a blob.
+     */
+    if (buf == NULL) {
+	node->commit->serial = seqno_next();
+	return;
+    }
+
     /*
      * This is the only place we do interpretation of ignores.
      *
@@ -195,7 +205,8 @@ static void export_blob(node_t *node,
      * It is unclear what effect, if any, a .cvsignore in a subdirectory
      * is supposed to have, if any.
      */
-    bool is_ignore = strcmp(node->commit->master->name, ".cvsignore") == 0;
+    const rev_master *master = CREF_GET(const rev_master, node->commit->master);
+    bool is_ignore = strcmp(master->name, ".cvsignore") == 0;
     size_t extralen = 0;
 
     export_stats.snapsize += len;
@@ -223,15 +234,9 @@ static void export_blob(node_t *node,
 
     node->commit->serial = seqno_next();
 
-    /*
-     * FIXME: Someday, avoid this I/O when incremental-dumping.  For
-     * some unknown reason the obvious test opts->fromtime <
-     * node->commit->date fails - emits too few blobs - but only
-     * if the -T option is not used. See test/badincr.sh
-     */
     char path[PATH_MAX];
     FILE *wfp;
-    blobfile(node->commit->master->name, node->commit->serial, true, path);
+    blobfile(master->name, node->commit->serial, true, path);
     wfp = fopen(path, "w");
 
     if (wfp == NULL)
@@ -249,6 +254,8 @@ static void export_blob(node_t *node,
 	    fputc(*cp, wfp);
 	}
 	fputc('\n', wfp);
+	export_stats.export_blobs++;
+	export_stats.spoolsize += ftell(wfp);
 	(void)fclose(wfp);
     }
 }
@@ -269,35 +276,20 @@ static void cleanup(const export_options_t *opts)
     nftw(blobdir, unlink_cb, 64, FTW_DEPTH | FTW_PHYS);
 }
 
-static const char *utc_offset_timestamp(const time_t *timep, const char *tz)
+static const char *utc_offset_timestamp(const time_t t, const tz_table *zone)
+/* git's "seconds +hhmm" form of a time; %z's rounding, without touching TZ */
 {
-    static char outbuf[BUFSIZ];
-    struct tm *tm;
-    char tzbuf[BUFSIZ];
-    /* coverity[tainted_string_return_content] */
-    char *oldtz = getenv("TZ");
-
-    // make a copy in case original is clobbered
-    if (oldtz != NULL)
-	strncpy(tzbuf, oldtz, sizeof(tzbuf)-1);
-
-    setenv("TZ", tz, 1);
-    tzset();  // just in case ...
-
-    tm = localtime(timep);
-#ifndef __CYGWIN__
-    strftime(outbuf, sizeof(outbuf), "%s %z", tm);
-#else
-		// Cygdwin doesn't have %s for strftime
-    int x = sprintf(outbuf, "%li", *timep);
-    strftime(outbuf + x, sizeof(outbuf) - x, " %z", tm);
-#endif
-    if (oldtz != NULL)
-	setenv("TZ", tzbuf, 1);
-    else
-	unsetenv("TZ");
-    tzset();
+    static char outbuf[64];
+    int offset = tz_offset(zone, t);
+    char sign = '+';
 
+    if (offset < 0) {
+	sign = '-';
+	offset = -offset;
+    }
+    offset /= 60;
+    snprintf(outbuf, sizeof(outbuf), "%lld %c%02d%02d",
+	     (long long)t, sign, offset / 60, offset % 60);
     return outbuf;
 }
 
@@ -318,8 +310,10 @@ struct fileop {
 static void dump_file(const cvs_commit *cvs_commit, FILE *fp)
 {
     char buf[CVS_MAX_REV_LEN + 1];
-    fprintf(fp, "   file name: %s %s\n", cvs_commit->master->name, 
-	    cvs_number_string(cvs_commit->number, buf, sizeof(buf)));
+    fprintf(fp, "   file name: %s %s\n",
+	    CREF_GET(const rev_master, cvs_commit->master)->name,
+	    cvs_number_string(CREF_GET(const cvs_number, cvs_commit->number),
+			      buf, sizeof(buf)));
 }
 
 static void dump_commit(const git_commit *commit, FILE *fp)
@@ -353,10 +347,12 @@ static void
 build_modify_op(cvs_commit *c, struct fileop *op)
 /* fill out a modify fileop from a cvs commit */
 {
+    const rev_master *master = CREF_GET(const rev_master, c->master);
+
     op->rev = c;
-    op->path = c->master->fileop_name;
+    op->path = master->fileop_name;
     op->op = 'M';
-    if (c->master->mode & 0100)
+    if (master->mode & 0100)
 	op->mode = 0755;
     else
 	op->mode = 0644;
@@ -367,10 +363,13 @@ append_revpair(cvs_commit *c, const export_options_t *opts,
 	       char **revpairs, size_t *revpairsize)
 /* append file information if requested */
 {
+    if (revpairs == NULL)
+	return;
     if (opts->revision_map || opts->reposurgeon || opts->embed_ids) {
 	char fr[BUFSIZ];
 	int xtr = opts->embed_ids ? 10 : 2;
-	stringify_revision(c->master->name, " ", c->number, fr, sizeof fr);
+	stringify_revision(CREF_GET(const rev_master, c->master)->name, " ",
+			   CREF_GET(const cvs_number, c->number), fr, sizeof fr);
 	if (strlen(*revpairs) + strlen(fr) + xtr > *revpairsize) {
 	    *revpairsize *= 2;
 	    *revpairs = xrealloc(*revpairs, *revpairsize, "revpair allocation");
@@ -389,7 +388,7 @@ static void
 build_delete_op(cvs_commit *c, struct fileop *op)
 {
     op->op = 'D';
-    op->path = c->master->fileop_name;
+    op->path = CREF_GET(const rev_master, c->master)->fileop_name;
 }
 
 static const char *
@@ -402,34 +401,14 @@ visualize_branch_name(const char *name)
 	return name;
 }
 
-static void
-export_commit(git_commit *commit, const char *branch,
-	      const bool report, const export_options_t *opts)
-/* export a commit and the blobs it is the first to reference */
+static struct fileop *
+build_fileops(const git_commit *commit, const export_options_t *opts,
+	      struct fileop **operations, struct fileop *op, int *noperations,
+	      char **revpairs, size_t *revpairsize)
+/* fill the operations list for a commit, returning the end of the list */
 {
-    const git_commit *parent = commit->parent;
+    const git_commit *parent = CREF_GET(const git_commit, commit->parent);
     cvs_commit *cc;
-    cvs_author *author;
-    const char *full;
-    const char *email;
-    const char *timezone;
-    char *revpairs = NULL;
-    size_t revpairsize = 0;
-    time_t ct;
-    struct fileop *operations, *op, *op2;
-    int noperations;
-    serial_t here;
-    static const char *s_gitignore;
-
-    if (!s_gitignore) s_gitignore = atom(".gitignore");
-
-    if (opts->reposurgeon || opts->revision_map || opts->embed_ids) {
-	revpairs = xmalloc((revpairsize = 1024), "revpair allocation");
-	revpairs[0] = '\0';
-    }
-
-    noperations = OP_CHUNK;
-    op = operations = xmalloc(sizeof(struct fileop) * noperations, "fileop allocation");
 
     /* Perform a merge join between files in commit and files in parent commit
      * to determine modified (including new) and deleted files  between commits.
@@ -463,8 +442,8 @@ export_commit(git_commit *commit, const char *branch,
 	    if (pc->master == cc->master) {
 		/* file exists in commit and parent, but different revisions, modify op */
 		build_modify_op(cc, op);
-		append_revpair(cc, opts, &revpairs, &revpairsize);
-		op = next_op_slot(&operations, op, &noperations);
+		append_revpair(cc, opts, revpairs, revpairsize);
+		op = next_op_slot(operations, op, noperations);
 		pc = revdir_iter_next(parent_iter);
 		cc = revdir_iter_next(commit_iter);
 		continue;
@@ -473,29 +452,63 @@ export_commit(git_commit *commit, const char *branch,
 	    if (pc->master < cc->master) {
 		/* parent but no child, delete op */
 		build_delete_op(pc, op);
-		op = next_op_slot(&operations, op, &noperations);
+		op = next_op_slot(operations, op, noperations);
 		pc = revdir_iter_next(parent_iter);
 	    } else {
 		/* child but no parent, modify op */
 		build_modify_op(cc, op);
-		append_revpair(cc, opts, &revpairs, &revpairsize);
-		op = next_op_slot(&operations, op, &noperations);
+		append_revpair(cc, opts, revpairs, revpairsize);
+		op = next_op_slot(operations, op, noperations);
 		cc = revdir_iter_next(commit_iter);
 	    }
 	}
 	for (; pc; pc = revdir_iter_next(parent_iter)) {
 	    /* parent but no child, delete op */
 	    build_delete_op(pc, op);
-	    op = next_op_slot(&operations, op, &noperations);
+	    op = next_op_slot(operations, op, noperations);
 	}
     }
     for (; cc; cc = revdir_iter_next(commit_iter)) {
 	/* child but no parent, modify op */
 	build_modify_op(cc, op);
-	append_revpair(cc, opts, &revpairs, &revpairsize);
-	op = next_op_slot(&operations, op, &noperations);
+	append_revpair(cc, opts, revpairs, revpairsize);
+	op = next_op_slot(operations, op, noperations);
     }
 
+    return op;
+}
+
+static void
+export_commit(git_commit *commit, const char *branch,
+	      const bool report, const export_options_t *opts)
+/* export a commit and the blobs it is the first to reference */
+{
+    cvs_author *author;
+    const char *full;
+    const char *email;
+    const tz_table *zone;
+    char *revpairs = NULL;
+    size_t revpairsize = 0;
+    time_t ct;
+    struct fileop *operations, *op, *op2;
+    int noperations;
+    serial_t here;
+    static const char *s_gitignore;
+    static const tz_table *utc;
+
+    if (!s_gitignore) s_gitignore = atom(".gitignore");
+    if (!utc) utc = tz_compile("UTC");
+
+    if (opts->reposurgeon || opts->revision_map || opts->embed_ids) {
+	revpairs = xmalloc((revpairsize = 1024), "revpair allocation");
+	revpairs[0] = '\0';
+    }
+
+    noperations = OP_CHUNK;
+    op = operations = xmalloc(sizeof(struct fileop) * noperations, "fileop allocation");
+    op = build_fileops(commit, opts, &operations, op, &noperations,
+		       &revpairs, &revpairsize);
+
     for (op2 = operations; op2 < op; op2++) {
 	if (op2->op == 'M' && !op2->rev->emitted) {
 	    markmap[op2->rev->serial] = ++mark;
@@ -521,15 +534,15 @@ export_commit(git_commit *commit, const char *branch,
 	}
     }
 
-    author = fullname(commit->author);
+    author = fullname(CREF_GET(const char, commit->author));
     if (!author) {
-	full = commit->author;
-	email = commit->author;
-	timezone = "UTC";
+	full = CREF_GET(const char, commit->author);
+	email = CREF_GET(const char, commit->author);
+	zone = utc;
     } else {
 	full = author->full;
 	email = author->email;
-	timezone = author->timezone ? author->timezone : "UTC";
+	zone = author->zone ? author->zone : utc;
     }
 
     if (report)
@@ -547,23 +560,25 @@ export_commit(git_commit *commit, const char *branch,
 	const char *ts;
 	printf("mark :%d\n", (int)mark);
 	ct = display_date(commit, mark, opts->force_dates);
-	ts = utc_offset_timestamp(&ct, timezone);
+	ts = utc_offset_timestamp(ct, zone);
 	//printf("author %s <%s> %s\n", full, email, ts);
 	printf("committer %s <%s> %s\n", full, email, ts);
+	const char *log = log_text(CREF_GET(const char, commit->log));
+	const git_commit *parent = CREF_GET(const git_commit, commit->parent);
 	if (!opts->embed_ids)
-	    printf("data %zd\n%s", (ssize_t)strlen(commit->log), commit->log);
+	    printf("data %zd\n%s", (ssize_t)strlen(log), log);
 	else
-	    printf("data %zd\n%s\n%s", strlen(commit->log) + strlen(revpairs) + 1,
-		commit->log, revpairs);
-	if (commit->parent) {
-	    if (markmap[commit->parent->serial] == 0)
+	    printf("data %zd\n%s\n%s", strlen(log) + strlen(revpairs) + 1,
+		log, revpairs);
+	if (parent) {
+	    if (markmap[parent->serial] == 0)
 	    {
 		cleanup(opts);
 		/* should never happen */
 		fatal_error("internal error: child commit emitted before parent exists");
 	    }
-	    else if (opts->fromtime < commit->parent->date)
-		printf("from :%d\n", (int)markmap[commit->parent->serial]);
+	    else if (opts->fromtime < parent->date)
+		printf("from :%d\n", (int)markmap[parent->serial]);
 	}
 
 	for (op2 = operations; op2 < op; op2++)
@@ -608,7 +623,6 @@ export_commit(git_commit *commit, const char *branch,
 
     if (report)
 	printf("\n");
-#undef OP_CHUNK
 }
 
 static int export_ncommit(const git_repo *rl)
@@ -622,7 +636,7 @@ static int export_ncommit(const git_repo *rl)
 	if (h->tail)
 	    continue;
 	/* PUNNING: see the big comment in cvs.h */ 
-	for (c = (git_commit *)h->commit; c; c = c->parent) {
+	for (c = (git_commit *)h->commit; c; c = CREF_GET(git_commit, c->parent)) {
 	    n++;
 	    if (c->tail)
 		break;
@@ -676,10 +690,10 @@ static struct commit_seq *canonicalize(git_repo *rl)
 	if (!h->tail) {
 	    int i = 0, branchlength = 0;
 	    /* PUNNING: see the big comment in cvs.h */ 
-	    for (c = (git_commit *)h->commit; c; c = (c->tail ? NULL : c->parent))
+	    for (c = (git_commit *)h->commit; c; c = (c->tail ? NULL : CREF_GET(git_commit, c->parent)))
 		branchlength++;
 	    /* PUNNING: see the big comment in cvs.h */ 
-	    for (c = (git_commit *)h->commit; c; c = (c->tail ? NULL : c->parent)) {
+	    for (c = (git_commit *)h->commit; c; c = (c->tail ? NULL : CREF_GET(git_commit, c->parent))) {
 		/* copy commits in reverse order into this branch's span */
 		n = branchbase + branchlength - (i + 1);
 		history[n].commit = c;
@@ -706,7 +720,7 @@ static struct commit_seq *canonicalize(git_repo *rl)
      */
     for (hp = history+1; hp < history + export_stats.export_total_commits; hp++) {
 	struct commit_seq sc, *tp, *bp = hp;
-#define is_parent_of(x, y) (((struct commit_seq *)x)->commit == ((struct commit_seq *)y)->commit->parent)
+#define is_parent_of(x, y) (((struct commit_seq *)x)->commit == CREF_GET(git_commit, ((struct commit_seq *)y)->commit->parent))
 #define is_branchroot_of(x, y) ((x)->head == (y)->head && (x)->isbase)
 #define is_older_than(x, y) (((struct commit_seq *)x)->commit->date < ((struct commit_seq *)y)->commit->date)
 	/* back up as far as we can */
@@ -725,37 +739,65 @@ static struct commit_seq *canonicalize(git_repo *rl)
     return history;
 }
 
-void export_authors(forest_t *forest, export_options_t *opts)
-/* dump a list of author IDs in the repository */
+static void mark_wanted(const struct commit_seq *history,
+			const export_options_t *opts)
+/* flag the CVS revisions an incremental dump will actually ship */
 {
-    const char **authors;
-    int i, nauthors = 0;
-    size_t alloc;
-    authors = NULL;
-    alloc = 0;
-    export_stats.export_total_commits = export_ncommit(forest->git);
-    struct commit_seq *hp, *history = canonicalize(forest->git);
-
-    progress_begin("Finding authors...", NO_MAX);
+    /*
+     * This is a dry run of the mark arithmetic in the export loop.
+     * Whether a commit is reported depends on display_date(), which
+     * under -T is a function of the mark about to be assigned, and an
+     * unshipped blob gets a fresh mark every time an unreported commit
+     * references it - so the marks have to be counted exactly.
+     *
+     * Comparing fromtime against the CVS revision date is not enough.
+     * A clique member can be older than the changeset date, and the
+     * first reported commit on a branch ships every file that differs
+     * from its unreported parent.  That is why the naive test emitted
+     * too few blobs whenever -T didn't mask the real dates.
+     */
+    const struct commit_seq *hp;
+    struct fileop *operations, *op, *op2;
+    int noperations = OP_CHUNK;
+    serial_t simmark = opts->basemark;
+
+    operations = xmalloc(sizeof(struct fileop) * noperations, "fileop allocation");
     for (hp = history; hp < history + export_stats.export_total_commits; hp++) {
-	for (i = 0; i < nauthors; i++) {
-	    if (authors[i] == hp->commit->author)
-		goto duplicate;
-	}
-	if (nauthors >= alloc) {
-	    alloc += 1024;
-	    authors = xrealloc(authors, sizeof(char*) * alloc, "author list");
+	bool report = opts->fromtime < display_date(hp->commit, simmark+1, opts->force_dates);
+	op = build_fileops(hp->commit, opts, &operations, operations, &noperations,
+			   NULL, NULL);
+	for (op2 = operations; op2 < op; op2++) {
+	    if (op2->op == 'M' && !op2->rev->wanted) {
+		++simmark;
+		if (report)
+		    op2->rev->wanted = true;
+	    }
 	}
-	authors[nauthors++] = hp->commit->author;
-    duplicate:;
+	++simmark;
     }
-    progress_end("done");
+    free(operations);
+#undef OP_CHUNK
+}
+
+static bool generator_wanted(const generator_t *gen)
+/* does an incremental dump ship any revision of this master? */
+{
+    for (const cvs_version *v = gen->versions; v; v = v->next)
+	if (v->node->commit != NULL && v->node->commit->wanted)
+	    return true;
+    return false;
+}
+
+void export_authors(forest_t *forest, export_options_t *opts)
+/* dump a list of author IDs in the repository */
+{
+    size_t i, nauthors;
+    const char **authors = author_list(&nauthors);
 
     for (i = 0; i < nauthors; i++)
 	printf("%s\n", authors[i]);
 
     free(authors);
-    free(history);
 }
 
 void export_commits(forest_t *forest, 
@@ -770,7 +812,8 @@ void export_commits(forest_t *forest,
 	
     if (tmp == NULL) 
 	tmp = "/tmp";
-    seqno = mark = 0;
+    seqno = 0;
+    mark = opts->basemark;
     snprintf(blobdir, sizeof(blobdir), "%s/cvs-fast-export-XXXXXX", tmp);
     if (mkdtemp(blobdir) == NULL)
 	fatal_error("temp dir creation failed\n");
@@ -779,28 +822,45 @@ void export_commits(forest_t *forest,
     setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
 
     export_stats.export_total_commits = export_ncommit(rl);
+    export_stats.last_date = opts->fromtime;
+    export_stats.last_mark = opts->basemark;
     /* the +1 is because mark indices are 1-origin, slot 0 always empty */
     markmap = (serial_t *)xcalloc(sizeof(serial_t),
 				  forest->total_revisions + export_stats.export_total_commits + 1,
 				  "markmap allocation");
 
+    struct commit_seq *history, *hp;
+
+    history = canonicalize(rl);
+    gather_stats("after canonicalize");
+
+    /* an incremental dump only needs the blobs its reported commits ship */
+    if (opts->fromtime > 0)
+	mark_wanted(history, opts);
+
     progress_begin("Generating snapshots...", forest->filecount);
     for (gp = forest->generators; 
 	 gp < forest->generators + forest->filecount;
 	 gp++) {
-	generate_files(gp, opts, export_blob);
+	spill_fetch(gp - forest->generators, gp);
+	if (opts->fromtime > 0 && !generator_wanted(gp)) {
+	    /* nothing to materialize, but serials are still needed */
+	    for (const cvs_version *v = gp->versions; v; v = v->next)
+		if (v->node->commit != NULL && !v->node->commit->dead)
+		    v->node->commit->serial = seqno_next();
+	} else
+	    generate_files(gp, opts, export_blob,
+			   master_profiles ? &master_profiles[gp - forest->generators] : NULL);
 	generator_free(gp);
 	progress_jump(++recount);
     }
     progress_end("done");
+    spill_end();
+    gather_stats("after generation");
 
     if (opts->reposurgeon)
         printf("#reposurgeon sourcetype %s\n",  forest->cvsroot ? "cvs" : "rcs");
 
-    struct commit_seq *history, *hp;
-
-    history = canonicalize(rl);
-
 #ifdef ORDERDEBUG2
     fputs("Export phase 2:\n", stderr);
     for (hp = history; hp < history + export_stats.export_total_commits; hp++)
@@ -817,7 +877,8 @@ void export_commits(forest_t *forest,
 		report = false;
 	    } else if (!hp->realized) {
 		struct commit_seq *lp;
-		if (hp->commit->parent != NULL && display_date(hp->commit->parent, markmap[hp->commit->parent->serial], opts->force_dates) < opts->fromtime)
+		const git_commit *parent = CREF_GET(const git_commit, hp->commit->parent);
+		if (parent != NULL && display_date(parent, markmap[parent->serial], opts->force_dates) < opts->fromtime)
 		    (void)printf("from %s%s^0\n\n", opts->branch_prefix, hp->head->ref_name);
 		for (lp = hp; lp < history + export_stats.export_total_commits; lp++) {
 		    if (lp->head == hp->head) {
@@ -828,6 +889,12 @@ void export_commits(forest_t *forest,
 	}
 	progress_jump(hp - history);
 	export_commit(hp->commit, hp->head->ref_name, report, opts);
+	if (report) {
+	    time_t date = display_date(hp->commit, markmap[hp->commit->serial], opts->force_dates);
+	    if (date > export_stats.last_date)
+		export_stats.last_date = date;
+	    export_stats.last_mark = mark;
+	}
 	for (t = all_tags; t; t = t->next)
 	    if (t->commit == hp->commit && display_date(hp->commit, markmap[hp->commit->serial], opts->force_dates) > opts->fromtime)
 		printf("reset refs/tags/%s\nfrom :%d\n\n", t->name, (int)markmap[hp->commit->serial]);
@@ -850,6 +917,7 @@ void export_commits(forest_t *forest,
     progress_end("done");
 
     fputs("done\n", stdout);
+    gather_stats("after emission");
 
     cleanup(opts);
 
@@ -566,8 +566,8 @@ static void keyreplace(editbuffer_t *eb, enum markers marker)
 	if (exp != EXPANDKV)
 	    out_putc(eb, KDELIM);
 
-	kw = eb->Glog;
-	ls = strlen(eb->Glog);
+	kw = log_text(eb->Glog);
+	ls = strlen(kw);
 	if (sizeof(ciklog)-1<=ls && !memcmp(kw,ciklog,sizeof(ciklog)-1))
 	    return;
 
@@ -1045,12 +1045,10 @@ static void enter_branch(editbuffer_t *eb, const node_t *const node)
 #endif
 }
 
-static node_t *generate_setup(generator_t *gen)
+static node_t *generate_setup(editbuffer_t *eb, const generator_t *gen)
 {
-    if (gen->nodehash.head_node != NULL)
+    if (gen->head_node != NULL)
     {
-	editbuffer_t *eb = &gen->editbuffer;
-
 	eb->Gkeyval = NULL;
 	eb->Gkvlen = 0;
 
@@ -1061,13 +1059,11 @@ static node_t *generate_setup(generator_t *gen)
 	Gline(eb) = NULL; Ggap(eb) = Ggapsize(eb) = Glinemax(eb) = 0;
     }
 
-    return gen->nodehash.head_node;
+    return gen->head_node;
 }
 
-static void generate_wrap(generator_t *gen)
+static void generate_wrap(editbuffer_t *eb)
 {
-    editbuffer_t *eb = &gen->editbuffer;
-
     free(eb->Gkeyval);
     eb->Gkeyval = NULL;
     eb->Gkvlen = 0;
@@ -1077,12 +1073,18 @@ static void generate_wrap(generator_t *gen)
 
 void generate_files(generator_t *gen,
 		    export_options_t *opts,
-		    void(*hook)(node_t *node, void *buf, size_t len, export_options_t *opts))
+		    void(*hook)(node_t *node, void *buf, size_t len, export_options_t *opts),
+		    master_profile *profile)
 /* export all the revision states of a CVS/RCS master through a hook */
 {
-    editbuffer_t *eb = &gen->editbuffer;
-    node_t *node = generate_setup(gen);
-
+    /* edit state is needed only while this master is being expanded */
+    editbuffer_t ebstore = {0}, *eb = &ebstore;
+    struct timespec start, end;
+    node_t *node;
+
+    if (profile || tracing)
+	clock_gettime(CLOCK_MONOTONIC, &start);
+    node = generate_setup(eb, gen);
     if (node == NULL)
 	return;
 
@@ -1090,12 +1092,20 @@ void generate_files(generator_t *gen,
     eb->current->node_text = load_text(eb, &node->patch->text);
     process_delta(eb, node, ENTER);
     for (;;) {
-	if (node->commit != NULL && !node->commit->dead) {
+	if (profile && Glinemax(eb) - Ggapsize(eb) > profile->peak_lines)
+	    profile->peak_lines = Glinemax(eb) - Ggapsize(eb);
+	if (node->commit != NULL && !node->commit->dead
+	    && opts->fromtime > 0 && !node->commit->wanted) {
+	    /* an incremental dump will never ship this one */
+	    hook(node, NULL, 0, opts);
+	} else if (node->commit != NULL && !node->commit->dead) {
 	    out_buffer_init(eb);
 	    if (eb->Gexpand != EXPANDKB && eb->Gexpand != EXPANDKO)
 		expandedit(eb);
 	    else
 		snapshotedit(eb);
+	    if (profile)
+		profile->snapsize += out_buffer_count(eb);
 	    hook(node, out_buffer_text(eb), out_buffer_count(eb), opts);
 	    out_buffer_cleanup(eb);
 	}
@@ -1123,7 +1133,13 @@ void generate_files(generator_t *gen,
 	process_delta(eb, node, EDIT);
     }
 Done:
-    generate_wrap(gen);
+    generate_wrap(eb);
+    if (profile || tracing) {
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (profile)
+	    profile->generate_time += seconds_diff(&end, &start);
+	trace_span(gen->master_name, "generate", &start, &end);
+    }
 }
 
 /* end */
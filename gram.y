@@ -209,7 +209,7 @@ revision	: NUMBER date author state branches next revtrailer
 				 cvstime2rfc3339($$->date));
 			}
 		    }
-		    hash_version(&cvsfile->gen.nodehash, $$);
+		    hash_version(&cvsfile->nodehash, $$);
 		    ++cvsfile->nversions;			
 		  }
 		;
@@ -233,7 +233,7 @@ numbers		: NUMBER numbers
 				    "gram.y::numbers");
 			$$->next = $2;
 			$$->number = atom_cvs_number($1);
-			hash_branch(&cvsfile->gen.nodehash, $$);
+			hash_branch(&cvsfile->nodehash, $$);
 		  }
 		|
 		  { $$ = NULL; }
@@ -264,13 +264,13 @@ patch		: NUMBER log text
 			    /* description is available because the
 			     * desc production has already been reduced */
 			    if (strlen(cvsfile->description) == 0)
-				    $$->log = atom("*** empty log message ***\n");
+				    $$->log = log_intern("*** empty log message ***\n");
 			    else
-				    $$->log = atom(cvsfile->description);
+				    $$->log = log_intern(cvsfile->description);
 		    } else
-			    $$->log = atom($2);
+			    $$->log = log_intern($2);
 		    $$->text = $3;
-		    hash_patch(&cvsfile->gen.nodehash, $$);
+		    hash_patch(&cvsfile->nodehash, $$);
 		    free($2);
 		  }
 		;
@@ -56,7 +56,7 @@ static bool
 cvs_commit_list_has_filename(const cvs_commit_list *fl, const char *name)
 {
     for (; fl; fl = fl->next)
-	if (fl->file->master->name == name)
+	if (CREF_GET(const rev_master, fl->file->master)->name == name)
 	    return true;
     return false;
 }
@@ -70,30 +70,36 @@ static void dot_commit_graph(git_commit *c, const rev_ref *branch)
 //	printf("*** TAIL");
     printf("\\n");
     printf("%s\\n", cvstime2rfc3339(c->date));
-    dump_log(stdout, c->log);
+    dump_log(stdout, log_text(CREF_GET(const char, c->log)));
     printf("\\n");
     if (difffiles) {
-	rev_diff    *diff = git_commit_diff(c->parent, c);
+	rev_diff    *diff = git_commit_diff(CREF_GET(git_commit, c->parent), c);
 	cvs_commit_list   *fl;
 
 	for (fl = diff->add; fl; fl = fl->next) {
-	    if (!cvs_commit_list_has_filename(diff->del, fl->file->master->name)) {
+	    if (!cvs_commit_list_has_filename(diff->del,
+		    CREF_GET(const rev_master, fl->file->master)->name)) {
 		printf("+");
-		dump_number(fl->file->master->name, fl->file->number);
+		dump_number(CREF_GET(const rev_master, fl->file->master)->name,
+			    CREF_GET(const cvs_number, fl->file->number));
 		printf("\\n");
 	    }
 	}
 	for (fl = diff->add; fl; fl = fl->next) {
-	    if (cvs_commit_list_has_filename(diff->del, fl->file->master->name)) {
+	    if (cvs_commit_list_has_filename(diff->del,
+		    CREF_GET(const rev_master, fl->file->master)->name)) {
 		printf("|");
-		dump_number(fl->file->master->name, fl->file->number);
+		dump_number(CREF_GET(const rev_master, fl->file->master)->name,
+			    CREF_GET(const cvs_number, fl->file->number));
 		printf("\\n");
 	    }
 	}
 	for (fl = diff->del; fl; fl = fl->next) {
-	    if (!cvs_commit_list_has_filename(diff->add, fl->file->master->name)) {
+	    if (!cvs_commit_list_has_filename(diff->add,
+		    CREF_GET(const rev_master, fl->file->master)->name)) {
 		printf("-");
-		dump_number(fl->file->master->name, fl->file->number);
+		dump_number(CREF_GET(const rev_master, fl->file->master)->name,
+			    CREF_GET(const cvs_number, fl->file->number));
 		printf("\\n");
 	    }
 	}
@@ -102,7 +108,8 @@ static void dot_commit_graph(git_commit *c, const rev_ref *branch)
 	cvs_commit  *f;
 	revdir_iter *r = revdir_iter_alloc(&c->revdir);
 	while ((f = revdir_iter_next(r))) {
-	    dump_number(f->master->name, f->number);
+	    dump_number(CREF_GET(const rev_master, f->master)->name,
+			CREF_GET(const cvs_number, f->number));
 	    printf("\\n");
 	}
 	free(r);
@@ -130,7 +137,7 @@ static rev_ref *dump_find_branch(git_repo *rl, const git_commit *commit)
 	if (h->tail)
 	    continue;
 	/* PUNNING: see the big comment in cvs.h */ 
-	for (c = (git_commit *)h->commit; c; c = c->parent)
+	for (c = (git_commit *)h->commit; c; c = CREF_GET(git_commit, c->parent))
 	{
 	    if (c == commit)
 		return h;
@@ -264,7 +271,7 @@ static void dot_tags(git_repo *rl, const char *title, const char *shape)
     free(v);
 }
 
-#define dump_get_rev_parent(c) ((c)->parent)
+#define dump_get_rev_parent(c) CREF_GET(git_commit, (c)->parent)
 
 static void dot_rev_graph_nodes(git_repo *rl, const char *title)
 {
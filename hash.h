@@ -1,6 +1,8 @@
 #ifndef _HASH_H_
 #define _HASH_H_
 
+#include <stdbool.h>
+#include <stdio.h>
 #include "cvstypes.h"
 
 hash_t
@@ -25,4 +27,21 @@ hash_mix_string(hash_t seed, const char *val);
 #define HASH_MIX(hash, val) hash = hash_mix((hash), (const char *)&(val), sizeof(val))
 #define HASH_COMBINE(h1, h2) ((h1) ^ (h2))
 
+/* chain-length and collision statistics for one hash table */
+typedef struct _hash_stats {
+    const char	*name;
+    size_t	buckets;	/* slots in the table */
+    size_t	used;		/* slots holding at least one entry */
+    size_t	entries;
+    size_t	longest;	/* longest chain or probe sequence */
+    bool	hashed;		/* entries keep their full hash... */
+    size_t	collisions;	/* ...and this many share one with another */
+} hash_stats;
+
+void
+hash_stats_chain(hash_stats *stats, size_t length);
+
+void
+hash_stats_report(FILE *fp, const hash_stats *stats);
+
 #endif /* _HASH_H_ */
@@ -44,7 +44,10 @@ static volatile generator_t *generators;
 static volatile int         err;
 
 static int total_files, striplen;
+master_profile *master_profiles;
 static int verbose;
+static const char *statedir;
+static bool from_image, collecting, authorlist, metadata_only, spilling;
 
 #ifdef THREADS
 static pthread_mutex_t revlist_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -116,36 +119,53 @@ atom_rectify_name(const char *raw)
 }
 
 static void
-rev_list_file(rev_file *file, analysis_t *out, cvs_master *cm, rev_master *rm) 
+rev_list_file(rev_file *file, const size_t i,
+	      analysis_t *out, cvs_master *cm, rev_master *rm) 
 {
     struct stat	buf;
+    struct timespec start, end;
     yyscan_t scanner;
     FILE *in;
     cvs_file *cvs;
 
-    in = fopen(file->name, "r");
-    if (!in) {
-	perror(file->name);
-	++err;
-	return;
-    }
-    if (stat(file->name, &buf) == -1) {
-	fatal_system_error("%s", file->name);
-    }
-
+    if (master_profiles || tracing)
+	clock_gettime(CLOCK_MONOTONIC, &start);
     cvs = xcalloc(1, sizeof(cvs_file), __func__);
     cvs->gen.master_name = file->name;
     cvs->gen.expand = EXPANDKB;
     cvs->export_name = file->rectified;
-    cvs->mode = buf.st_mode;
     cvs->verbose = verbose;
+    cvs->metadata_only = metadata_only;
+
+    if (from_image)
+	forest_image_fetch(i, cvs);
+    else {
+	in = fopen(file->name, "r");
+	if (!in) {
+	    perror(file->name);
+	    ++err;
+	    free(cvs);
+	    return;
+	}
+	if (stat(file->name, &buf) == -1) {
+	    fatal_system_error("%s", file->name);
+	}
+	cvs->mode = buf.st_mode;
+
+	if (statedir == NULL || !state_fetch(i, &buf, cvs)) {
+	    yylex_init(&scanner);
+	    yyset_in(in, scanner);
+	    /* a master that didn't parse cleanly must be reparsed next run */
+	    if (yyparse(scanner, cvs) == 0 && collecting)
+		state_store(i, &buf, cvs);
+	    yylex_destroy(scanner);
+	}
 
-    yylex_init(&scanner);
-    yyset_in(in, scanner);
-    yyparse(scanner, cvs);
-    yylex_destroy(scanner);
+	fclose(in);
+    }
+    if (from_image && collecting)
+	state_store(i, NULL, cvs);
 
-    fclose(in);
     if (cvs_master_digest(cvs, cm, rm) == NULL) {
 	warn("warning - master file %s has no revision number - ignore file\n", file->name);
 	cvs->gen.master_name = NULL;	/* blank out data of previous file */
@@ -153,8 +173,32 @@ rev_list_file(rev_file *file, analysis_t *out, cvs_master *cm, rev_master *rm)
 	out->total_revisions = cvs->nversions;
 	out->skew_vulnerable = cvs->skew_vulnerable;
     }
+    if (master_profiles) {
+	master_profile *mp = &master_profiles[i];
+	const cvs_symbol *s;
+	const rev_ref *h;
+
+	mp->name = file->name;
+	mp->revisions = cvs->nversions;
+	for (s = cvs->symbols; s; s = s->next)
+	    mp->symbols++;
+	for (h = cm->heads; h; h = h->next)
+	    mp->branches++;
+    }
+    /* the node table was only needed to link up the delta tree */
+    cvs->gen.head_node = cvs->nodehash.head_node;
+    cvs->gen.nodes = unhash_nodes(&cvs->nodehash);
+    /* with no snapshots to generate, the delta tree can go now */
+    if (metadata_only)
+	generator_free(&cvs->gen);
     out->generator = cvs->gen;
     cvs_file_free(cvs);
+    if (master_profiles || tracing) {
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (master_profiles)
+	    master_profiles[i].parse_time = seconds_diff(&end, &start);
+	trace_span(file->name, "parse", &start, &end);
+    }
 }
 
 static int
@@ -186,27 +230,38 @@ static void *worker(void *arg)
 	/* pop a master off the queue, terminating if none left */
 #ifdef THREADS
 	if (threads > 1)
-	    pthread_mutex_lock(&enqueue_mutex);
+	    TRACE_LOCK(&enqueue_mutex, "enqueue_mutex");
 #endif /* THREADS */
 	size_t i = fn_i++;
 #ifdef THREADS
 	if (threads > 1)
 	    pthread_mutex_unlock(&enqueue_mutex);
 #endif /* THREADS */
-	if (i >= fn_n)
+	if (i >= fn_n) {
+#ifdef THREADS
+	    if (threads > 1)
+		gather_thread_stats();
+#endif /* THREADS */
 	    return(NULL);
+	}
 
 	/* process it */
-	rev_list_file(&sorted_files[i], &out, &cvs_masters[i], &rev_masters[i]);
+	rev_list_file(&sorted_files[i], i, &out, &cvs_masters[i], &rev_masters[i]);
+	if (spilling && out.generator.master_name != NULL)
+	    spill_store(i, &out.generator, &rev_masters[i]);
 
 	/* pass it to the next stage */
 #ifdef THREADS
 	if (threads > 1)
-	    pthread_mutex_lock(&revlist_mutex);
+	    TRACE_LOCK(&revlist_mutex, "revlist_mutex");
 #endif /* THREADS */
-	if ((generators[i] = out.generator).master_name != NULL) {
+	if (generators != NULL)
+	    generators[i] = out.generator;
+	if (out.generator.master_name != NULL) {
 	    progress_jump(++load_current_file);
 	    total_revisions += out.total_revisions;
+	    if (authorlist)
+		author_collect(&cvs_masters[i]);
 	    if (out.skew_vulnerable > skew_vulnerable)
 		skew_vulnerable = out.skew_vulnerable;
 	}
@@ -322,8 +377,13 @@ void analyze_masters(int argc, const char *argv[],
     striplen = analyzer->striplen;
 
     forest->textsize = forest->filecount = 0;
-    progress_begin("Reading file list...", NO_MAX);
-    for (;;)
+    from_image = analyzer->load_forest != NULL;
+    if (from_image) {
+	progress_begin("Mapping forest image...", NO_MAX);
+	total_files = forest_image_open(analyzer->load_forest, forest);
+    } else
+	progress_begin("Reading file list...", NO_MAX);
+    while (!from_image)
     {
 	struct stat stb;
 	if (argc < 2) {
@@ -376,10 +436,24 @@ void analyze_masters(int argc, const char *argv[],
     }
     forest->filecount = total_files;
 
-    generators = xcalloc(sizeof(generator_t), total_files, "Generators");
+    /*
+     * Reports that need no snapshots (-g, -a) skip delta text and keep
+     * no generators.  Not when the parse is being saved, though, as a
+     * later export will want the text locations from the cache.
+     */
+    metadata_only = analyzer->metadata_only
+	&& analyzer->statedir == NULL && analyzer->save_forest == NULL;
+    if (!metadata_only)
+	generators = xcalloc(sizeof(generator_t), total_files, "Generators");
+    spilling = analyzer->spill && !metadata_only;
+    if (spilling)
+	spill_begin(total_files);
+    if (analyzer->profile_masters != NULL)
+	master_profiles = xcalloc(total_files, sizeof(master_profile),
+				  "master profile");
     sorted_files = xmalloc(sizeof(rev_file) * total_files, "sorted_files");
     cvs_masters = xcalloc(total_files, sizeof(cvs_master), "cvs_masters");
-    rev_masters = xmalloc(sizeof(rev_master) * total_files, "rev_masters");
+    rev_masters = compact_alloc(sizeof(rev_master) * total_files, "rev_masters");
     fn_n = total_files;
     i = 0;
     rev_filename *tn;
@@ -396,15 +470,28 @@ void analyze_masters(int argc, const char *argv[],
      * It also causes operations to come out in correct fileop_sort order.
      * Note some output names are different to input names.
      * e.g. .cvsignore becomes .gitignore
+     *
+     * A forest image was saved in this order.
      */
-    qsort(sorted_files, total_files, sizeof(rev_file), file_compare);
+    if (from_image) {
+	for (i = 0; i < total_files; i++)
+	    forest_image_master(i, &sorted_files[i].name,
+				&sorted_files[i].rectified);
+    } else
+	qsort(sorted_files, total_files, sizeof(rev_file), file_compare);
 	
     progress_end("done, %.3fKB in %d files",
 		 (forest->textsize/1024.0), forest->filecount);
+    gather_stats("after list read");
 
     /* things that must be visible to inner functions */
     load_current_file = 0;
     verbose = analyzer->verbose;
+    statedir = from_image ? NULL : analyzer->statedir;
+    collecting = statedir != NULL || analyzer->save_forest != NULL;
+    authorlist = analyzer->authorlist;
+    if (collecting)
+	state_begin(statedir, total_files);
 
     /*
      * Analyze the files for CVS revision structure.
@@ -444,6 +531,12 @@ void analyze_masters(int argc, const char *argv[],
 
     progress_end("done, %d revisions", (int)total_revisions);
     free(sorted_files);
+    if (analyzer->save_forest != NULL)
+	forest_image_save(analyzer->save_forest, forest);
+    if (collecting)
+	state_end();
+    if (from_image)
+	forest_image_close();
 
     forest->errcount = err;
     forest->total_revisions = total_revisions;
@@ -452,4 +545,56 @@ void analyze_masters(int argc, const char *argv[],
     forest->generators = (generator_t *)generators;
 }
 
+/* how many of the costliest masters profile_masters_report() announces */
+#define PROFILE_TOP	10
+
+static int
+profile_compare(const void *a, const void *b)
+/* costliest master first */
+{
+    const master_profile *pa = *(const master_profile * const *)a;
+    const master_profile *pb = *(const master_profile * const *)b;
+    double ca = pa->parse_time + pa->generate_time;
+    double cb = pb->parse_time + pb->generate_time;
+
+    if (ca != cb)
+	return ca < cb ? 1 : -1;
+    return strcmp(pa->name, pb->name);
+}
+
+void
+profile_masters_report(FILE *fp)
+/* list the costliest masters, and write the whole table to fp */
+{
+    master_profile	**order;
+    int			i, n = 0;
+
+    if (master_profiles == NULL) {
+	fclose(fp);
+	return;
+    }
+    order = xmalloc(total_files * sizeof(master_profile *), __func__);
+    for (i = 0; i < total_files; i++)
+	if (master_profiles[i].name != NULL)
+	    order[n++] = &master_profiles[i];
+    qsort(order, n, sizeof(master_profile *), profile_compare);
+
+    fprintf(STATUS, "Costliest masters (parse + generate seconds):\n");
+    for (i = 0; i < n && i < PROFILE_TOP; i++)
+	fprintf(STATUS, "%10.3f  %s\n",
+		order[i]->parse_time + order[i]->generate_time,
+		order[i]->name);
+
+    fprintf(fp, "#parse\tgenerate\trevisions\tbranches\tsymbols\tsnapshot_bytes\tpeak_lines\tmaster\n");
+    for (i = 0; i < n; i++)
+	fprintf(fp, "%.6f\t%.6f\t%u\t%u\t%u\t%.0f\t%zu\t%s\n",
+		order[i]->parse_time, order[i]->generate_time,
+		(unsigned)order[i]->revisions,
+		order[i]->branches, order[i]->symbols,
+		order[i]->snapsize, order[i]->peak_lines,
+		order[i]->name);
+    fclose(fp);
+    free(order);
+}
+
 /* end */
@@ -0,0 +1,274 @@
+/*
+ * Keep commit log messages compressed in memory.
+ *
+ * Log text is by far the bulkiest thing the parser keeps, and nothing
+ * reads it between parsing and export except to ask whether two
+ * commits have the same message.  With LOGSTORE defined, messages are
+ * interned here instead of with atom(): each distinct message is
+ * appended to an open block, blocks are zlib-compressed as they fill,
+ * and what the rest of the program holds is a handle - the address of
+ * the message's entry - that is unique per message just as an atom is,
+ * so commits still compare logs by pointer.  log_text() turns a handle
+ * back into text through a small cache of decompressed blocks; since
+ * masters are parsed and commits exported in roughly the same order,
+ * consecutive lookups mostly land in the same few blocks.
+ *
+ * Duplicates are found by hash and length and then confirmed against
+ * the stored text, so a hash collision can never merge two messages.
+ *
+ *  SPDX-License-Identifier: GPL-2.0+
+ */
+
+#include "cvs.h"
+#include "hash.h"
+
+#ifdef LOGSTORE
+#include <stdint.h>
+#include <zlib.h>
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
+
+#define LOG_BLOCK	16384	/* uncompressed bytes per block */
+#define LOG_CACHE	64	/* decompressed blocks kept */
+#define LOG_INITIAL	1024	/* must be a power of 2 */
+
+typedef struct _log_entry {
+    struct _log_entry	*next;
+    hash_t		hash;
+    uint32_t		block;
+    uint32_t		offset;
+    uint32_t		length;
+} log_entry;
+
+typedef struct _log_block {
+    unsigned char	*data;
+    uint32_t		zlength, length;
+} log_block;
+
+static struct {
+    log_entry	**buckets;
+    size_t	mask, nentries;
+    log_block	*blocks;
+    uint32_t	nblocks, sblocks;
+    char	*open;			/* text of block nblocks */
+    size_t	nopen, sopen;
+    size_t	textsize;		/* total uncompressed */
+    size_t	misses, lookups;
+    struct {
+	uint32_t	block;
+	char		*text;
+	size_t		size;
+    } cache[LOG_CACHE];
+} store;
+
+#ifdef THREADS
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif /* THREADS */
+
+static __thread char	*text_buf;
+static __thread size_t	text_size;
+
+static void
+log_flush(void)
+/* compress the open block and start another */
+{
+    log_block	*b;
+    uLongf	zlength = compressBound(store.nopen);
+
+    if (store.nblocks == store.sblocks) {
+	store.sblocks = store.sblocks ? store.sblocks * 2 : 64;
+	store.blocks = xrealloc(store.blocks,
+				store.sblocks * sizeof(log_block), "log blocks");
+    }
+    b = &store.blocks[store.nblocks];
+    b->data = xmalloc(zlength, "log blocks");
+    if (compress2(b->data, &zlength, (const Bytef *)store.open, store.nopen,
+		  Z_BEST_SPEED) != Z_OK)
+	fatal_error("log store: compression failed\n");
+    b->data = xrealloc(b->data, zlength, "log blocks");
+    b->zlength = (uint32_t)zlength;
+    b->length = (uint32_t)store.nopen;
+    store.nblocks++;
+    store.nopen = 0;
+}
+
+static const char *
+log_block_text(const uint32_t block)
+/* the uncompressed text of a block; caller holds the store lock */
+{
+    size_t	slot = block % LOG_CACHE;
+    log_block	*b;
+    uLongf	length;
+
+    if (block == store.nblocks)
+	return store.open;
+    store.lookups++;
+    if (store.cache[slot].text != NULL && store.cache[slot].block == block)
+	return store.cache[slot].text;
+    store.misses++;
+    b = &store.blocks[block];
+    if (store.cache[slot].size < b->length) {
+	store.cache[slot].size = b->length;
+	store.cache[slot].text = xrealloc(store.cache[slot].text, b->length,
+					  "log cache");
+    }
+    length = b->length;
+    if (uncompress((Bytef *)store.cache[slot].text, &length,
+		   b->data, b->zlength) != Z_OK || length != b->length)
+	fatal_error("log store: block %u is corrupt\n", block);
+    store.cache[slot].block = block;
+    return store.cache[slot].text;
+}
+
+static void
+log_rehash(void)
+/* double the table */
+{
+    log_entry	**old = store.buckets, *e;
+    size_t	i, oldsize = store.mask + 1;
+
+    store.mask = oldsize * 2 - 1;
+    store.buckets = xcalloc(oldsize * 2, sizeof(log_entry *), "log store");
+    for (i = 0; i < oldsize; i++)
+	while ((e = old[i])) {
+	    old[i] = e->next;
+	    e->next = store.buckets[e->hash & store.mask];
+	    store.buckets[e->hash & store.mask] = e;
+	}
+    free(old);
+}
+
+const char *
+log_intern(const char *text)
+/* store a log message once, returning a handle that stands for it */
+{
+    hash_t	hash = hash_string(text);
+    size_t	length = strlen(text);
+    log_entry	*e, **head;
+
+#ifdef THREADS
+    if (threads > 1)
+	TRACE_LOCK(&store_mutex, "log store_mutex");
+#endif /* THREADS */
+    if (store.buckets == NULL) {
+	store.mask = LOG_INITIAL - 1;
+	store.buckets = xcalloc(LOG_INITIAL, sizeof(log_entry *), "log store");
+    }
+    head = &store.buckets[hash & store.mask];
+    for (e = *head; e; e = e->next)
+	if (e->hash == hash && e->length == length
+	    && !memcmp(log_block_text(e->block) + e->offset, text, length))
+	    goto found;
+
+    if (store.nopen > 0 && store.nopen + length + 1 > LOG_BLOCK)
+	log_flush();
+    if (store.nopen + length + 1 > store.sopen) {
+	store.sopen = length + 1 > LOG_BLOCK ? length + 1 : LOG_BLOCK;
+	store.open = xrealloc(store.open, store.sopen, "log blocks");
+    }
+    e = compact_alloc(sizeof(log_entry), "log store");
+    e->hash = hash;
+    e->block = store.nblocks;
+    e->offset = (uint32_t)store.nopen;
+    e->length = (uint32_t)length;
+    memcpy(store.open + store.nopen, text, length + 1);
+    store.nopen += length + 1;
+    store.textsize += length + 1;
+    e->next = *head;
+    *head = e;
+    if (++store.nentries > store.mask)
+	log_rehash();
+found:
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_unlock(&store_mutex);
+#endif /* THREADS */
+    return (const char *)e;
+}
+
+const char *
+log_text(const char *log)
+/* the text behind a handle, valid until this thread's next call */
+{
+    const log_entry *e = (const log_entry *)log;
+
+    if (e == NULL)
+	return NULL;
+    if (text_size < e->length + 1) {
+	text_size = e->length + 1;
+	text_buf = xrealloc(text_buf, text_size, "log text");
+    }
+#ifdef THREADS
+    if (threads > 1)
+	TRACE_LOCK(&store_mutex, "log store_mutex");
+#endif /* THREADS */
+    memcpy(text_buf, log_block_text(e->block) + e->offset, e->length + 1);
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_unlock(&store_mutex);
+#endif /* THREADS */
+    return text_buf;
+}
+#endif /* LOGSTORE */
+
+void
+log_store_stats(FILE *fp)
+/* report how well the log store compresses and caches */
+{
+#ifdef LOGSTORE
+    hash_stats	logs = {.name = "log store"};
+    size_t	i, zsize = 0;
+
+    if (store.buckets == NULL)
+	return;
+    for (i = 0; i < store.nblocks; i++)
+	zsize += store.blocks[i].zlength;
+    fprintf(fp, "log store: %zu messages, %.3fM text in %u blocks, "
+	    "%.3fM compressed, %zu of %zu block lookups missed the cache\n",
+	    store.nentries, store.textsize / 1000000.0, store.nblocks,
+	    zsize / 1000000.0, store.misses, store.lookups);
+    for (i = 0; i <= store.mask; i++) {
+	const log_entry *e;
+	size_t length = 0;
+
+	for (e = store.buckets[i]; e; e = e->next)
+	    length++;
+	hash_stats_chain(&logs, length);
+    }
+    hash_stats_report(fp, &logs);
+#else
+    (void)fp;
+#endif /* LOGSTORE */
+}
+
+void
+log_store_free(void)
+/* discard all stored messages */
+{
+#ifdef LOGSTORE
+    size_t	i;
+
+#ifndef COMPACT_REFS
+    for (i = 0; store.buckets != NULL && i <= store.mask; i++)
+	while (store.buckets[i]) {
+	    log_entry *e = store.buckets[i];
+	    store.buckets[i] = e->next;
+	    free(e);
+	}
+#endif /* COMPACT_REFS */
+    free(store.buckets);
+    for (i = 0; i < store.nblocks; i++)
+	free(store.blocks[i].data);
+    free(store.blocks);
+    free(store.open);
+    for (i = 0; i < LOG_CACHE; i++)
+	free(store.cache[i].text);
+    memset(&store, 0, sizeof(store));
+    free(text_buf);
+    text_buf = NULL;
+    text_size = 0;
+#endif /* LOGSTORE */
+}
+
+/* end */
@@ -11,6 +11,9 @@
 #include <sys/stat.h>
 #include <sys/resource.h>
 #include "revdir.h"
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
 #if defined(__GLIBC__)
 #include <malloc.h>
 #endif /* __GLIBC__ */
@@ -36,28 +39,6 @@ static int get_int_substr(const char * str, const regmatch_t * p)
     return atoi(buff);
 }
 
-static time_t mktime_utc(const struct tm * tm, const char* tzbuf)
-{
-    /* coverity[tainted_string_return_content] */
-    char * old_tz = getenv("TZ");
-    time_t ret;
-
-    setenv("TZ", tzbuf, 1);
-
-    tzset();
-
-    ret = mktime((struct tm *)tm);
-
-    if (old_tz)
-	setenv("TZ", old_tz, 1);
-    else
-	unsetenv("TZ");
-
-    tzset();
-
-    return ret;
-}
-
 static time_t convert_date(const char *dte)
 /* accept a date in anything close to RFC3339 form */
 {
@@ -79,8 +60,7 @@ static time_t convert_date(const char *dte)
     {
 	regmatch_t * pm = match;
 	struct tm tm = {0};
-	char tzbuf[32];
-	int offseth, offsetm;
+	int offset;
 
 	/* first regmatch_t is match location of entire re */
 	pm++;
@@ -91,18 +71,13 @@ static time_t convert_date(const char *dte)
 	tm.tm_hour = get_int_substr(dte, pm++);
 	tm.tm_min  = get_int_substr(dte, pm++);
 	tm.tm_sec  = get_int_substr(dte, pm++);
-	offseth    = -get_int_substr(dte, pm++);
-
-	offsetm = offseth % 100;
-	if (offsetm < 0)
-	    offsetm *= -1;
-	offseth /= 100;
-	snprintf(tzbuf, sizeof(tzbuf), "UTC%+d:%d", offseth, offsetm);
+	offset     = get_int_substr(dte, pm++);
 
 	tm.tm_year -= 1900;
 	tm.tm_mon--;
 
-	return mktime_utc(&tm, tzbuf);
+	/* +hhmm east of UTC */
+	return utc_time(&tm) - (offset / 100 * 60 + offset % 100) * 60;
     }
     else
     {
@@ -128,6 +103,7 @@ static void print_sizes(void)
     printf("sizeof(cvs_patch)     = %zu\n", sizeof(cvs_patch));
     printf("sizeof(nodehash_t)    = %zu\n", sizeof(nodehash_t));
     printf("sizeof(editbuffer_t)  = %zu\n", sizeof(editbuffer_t));
+    printf("sizeof(generator_t)   = %zu\n", sizeof(generator_t));
     printf("sizeof(cvs_file)      = %zu\n", sizeof(cvs_file));
     printf("sizeof(rev_master)    = %zu\n", sizeof(rev_master));
     printf("sizeof(revdir)        = %zu\n", sizeof(revdir));
@@ -140,31 +116,182 @@ static void print_sizes(void)
     printf("sizeof(cvs_author)    = %zu\n", sizeof(cvs_author));
     printf("sizeof(chunk_t)       = %zu\n", sizeof(chunk_t));
     printf("sizeof(Tag)           = %zu\n", sizeof(tag_t));
+#ifdef COMPACT_REFS
+    printf("sizeof(cref_t)        = %zu\n", sizeof(cref_t));
+#endif /* COMPACT_REFS */
 }
 
 struct checkpoint {
     const char *legend;
     struct timespec timespec;
     struct rusage rusage;
+    long rss;			/* resident KB, -1 if unknown */
+    long long rchar, wchar;	/* bytes through read/write, -1 if unknown */
+    double *busy;		/* CPU seconds of workers that finished */
+    int nbusy;
 };
 
-static struct checkpoint checkpoints[5];
+static struct checkpoint checkpoints[MAX_CHECKPOINTS];
 static int ncheckpoints;
 
-static void gather_stats(const char *legend)
+/* worker CPU times not yet charged to a checkpoint */
+static double *pending_busy;
+static int npending_busy, spending_busy;
+#ifdef THREADS
+static pthread_mutex_t busy_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif /* THREADS */
+
+static void gather_proc_stats(struct checkpoint *chp)
+/* pick up what getrusage() doesn't report from /proc, where there is one */
+{
+    FILE *fp;
+    char line[BUFSIZ];
+    long size, pages;
+
+    chp->rss = -1;
+    chp->rchar = chp->wchar = -1;
+    if ((fp = fopen("/proc/self/statm", "r")) != NULL) {
+	if (fscanf(fp, "%ld %ld", &size, &pages) == 2)
+	    chp->rss = pages * (sysconf(_SC_PAGESIZE) / 1024);
+	fclose(fp);
+    }
+    if ((fp = fopen("/proc/self/io", "r")) != NULL) {
+	while (fgets(line, sizeof(line), fp) != NULL)
+	    if (sscanf(line, "rchar: %lld", &chp->rchar) != 1)
+		(void)sscanf(line, "wchar: %lld", &chp->wchar);
+	fclose(fp);
+    }
+}
+
+void gather_stats(const char *legend)
 /* gather resource usage statistics */
 {
+    struct checkpoint *chp;
+
     if (ncheckpoints >= sizeof(checkpoints)/sizeof(struct checkpoint)) {
-	announce("cran out of statistics slots %s", legend);
+	announce("ran out of statistics slots %s\n", legend);
 	return;
     }
 
-    checkpoints[ncheckpoints].legend = legend;
-    (void)clock_gettime(CLOCK_REALTIME, &checkpoints[ncheckpoints].timespec);
-    (void)getrusage(RUSAGE_SELF, &checkpoints[ncheckpoints].rusage);
+    chp = &checkpoints[ncheckpoints];
+    chp->legend = legend;
+    (void)clock_gettime(CLOCK_REALTIME, &chp->timespec);
+    (void)getrusage(RUSAGE_SELF, &chp->rusage);
+    gather_proc_stats(chp);
+    chp->busy = pending_busy;
+    chp->nbusy = npending_busy;
+    pending_busy = NULL;
+    npending_busy = spending_busy = 0;
+    memstats_checkpoint(legend);
+    trace_phase(legend);
     ncheckpoints++;
 }
 
+void gather_thread_stats(void)
+/* charge a finishing worker thread's CPU time to the current phase */
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+	return;
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_lock(&busy_mutex);
+#endif /* THREADS */
+    if (npending_busy == spending_busy) {
+	spending_busy = spending_busy ? spending_busy * 2 : 16;
+	pending_busy = xrealloc(pending_busy, spending_busy * sizeof(double),
+				"thread statistics");
+    }
+    pending_busy[npending_busy++] = ts.tv_sec + ts.tv_nsec / 1e9;
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_unlock(&busy_mutex);
+#endif /* THREADS */
+}
+
+static double timeval_seconds(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void json_delta(FILE *fp, const char *name, long long from, long long to)
+/* emit a counter difference, or null if the counter isn't available */
+{
+    if (from < 0 || to < 0)
+	fprintf(fp, ", \"%s\": null", name);
+    else
+	fprintf(fp, ", \"%s\": %lld", name, to - from);
+}
+
+static void write_stats(FILE *fp,
+			const forest_t *forest, const export_stats_t *stats)
+/* write the checkpoints as a JSON report, one object per phase */
+{
+    int i, j;
+
+    fprintf(fp, "{\n  \"version\": \"%s\",\n", VERSION);
+#ifdef THREADS
+    fprintf(fp, "  \"threads\": %d,\n", threads);
+#else
+    fprintf(fp, "  \"threads\": 1,\n");
+#endif /* THREADS */
+    fprintf(fp, "  \"phases\": [\n");
+    for (i = 1; i < ncheckpoints; i++) {
+	const struct checkpoint *prev = &checkpoints[i-1];
+	const struct checkpoint *chp = &checkpoints[i];
+
+	fprintf(fp, "    {\"phase\": \"%s\", \"wall\": %.6f, \"user\": %.6f, \"system\": %.6f",
+		chp->legend,
+		seconds_diff(&chp->timespec, &prev->timespec),
+		timeval_seconds(&chp->rusage.ru_utime)
+		- timeval_seconds(&prev->rusage.ru_utime),
+		timeval_seconds(&chp->rusage.ru_stime)
+		- timeval_seconds(&prev->rusage.ru_stime));
+	fprintf(fp, ", \"maxrss_kb\": %ld", chp->rusage.ru_maxrss);
+	if (chp->rss < 0)
+	    fprintf(fp, ", \"rss_kb\": null");
+	else
+	    fprintf(fp, ", \"rss_kb\": %ld", chp->rss);
+	json_delta(fp, "minor_faults",
+		   prev->rusage.ru_minflt, chp->rusage.ru_minflt);
+	json_delta(fp, "major_faults",
+		   prev->rusage.ru_majflt, chp->rusage.ru_majflt);
+	json_delta(fp, "read_bytes", prev->rchar, chp->rchar);
+	json_delta(fp, "written_bytes", prev->wchar, chp->wchar);
+	json_delta(fp, "block_reads",
+		   prev->rusage.ru_inblock, chp->rusage.ru_inblock);
+	json_delta(fp, "block_writes",
+		   prev->rusage.ru_oublock, chp->rusage.ru_oublock);
+	fprintf(fp, ", \"thread_busy\": [");
+	for (j = 0; j < chp->nbusy; j++)
+	    fprintf(fp, "%s%.6f", j ? ", " : "", chp->busy[j]);
+	fprintf(fp, "]}%s\n", i < ncheckpoints - 1 ? "," : "");
+    }
+    fprintf(fp, "  ],\n  \"counters\": {\n");
+    fprintf(fp, "    \"masters\": %d,\n", forest->filecount);
+    fprintf(fp, "    \"text_bytes\": %lld,\n", (long long)forest->textsize);
+    fprintf(fp, "    \"revisions\": %u,\n", forest->total_revisions);
+    fprintf(fp, "    \"commits\": %ld,\n", stats->export_total_commits);
+    fprintf(fp, "    \"blobs\": %ld,\n", stats->export_blobs);
+    fprintf(fp, "    \"snapshot_bytes\": %.0f,\n", stats->snapsize);
+    fprintf(fp, "    \"spool_bytes\": %.0f,\n", stats->spoolsize);
+    fprintf(fp, "    \"atoms\": %u,\n", natoms);
+    fprintf(fp, "    \"tags\": %zu\n", tag_count);
+    fprintf(fp, "  }\n}\n");
+}
+
+/* codes for long options with no single-letter equivalent */
+enum {
+    OPT_STATE = 256,
+    OPT_SAVE_FOREST,
+    OPT_LOAD_FOREST,
+    OPT_STATS,
+    OPT_PROFILE_MASTERS,
+    OPT_TRACE,
+    OPT_SPILL,
+};
+
 int
 main(int argc, char **argv)
 {
@@ -178,6 +305,7 @@ main(int argc, char **argv)
 	.branch_prefix = "refs/heads/",
     };
     export_stats_t	export_stats;
+    FILE		*statsfp = NULL;
 
     import_options_t import_options = {
 	.striplen = -1,
@@ -195,7 +323,7 @@ main(int argc, char **argv)
     clock_gettime(CLOCK_REALTIME, &export_options.start_time);
     memset(&export_stats, '\0', sizeof(export_stats_t));
 
-    /* force times using mktime to be interpreted in UTC */
+    /* force times using localtime to be interpreted in UTC */
     setenv("TZ", "UTC", 1);
 
     LOGFILE = stderr;
@@ -221,6 +349,13 @@ main(int argc, char **argv)
             { "incremental",        1, 0, 'i' },
             { "threads",	    1, 0, 't' },
             { "embed-id",           0, 0, 'E' },
+            { "state",              1, 0, OPT_STATE },
+            { "save-forest",        1, 0, OPT_SAVE_FOREST },
+            { "load-forest",        1, 0, OPT_LOAD_FOREST },
+            { "stats",              1, 0, OPT_STATS },
+            { "profile-masters",    1, 0, OPT_PROFILE_MASTERS },
+            { "trace",              1, 0, OPT_TRACE },
+            { "spill",              0, 0, OPT_SPILL },
 	    { "sizes",              0, 0, 'S' },	/* undocumented */
 	    { "noignores",          0, 0, 'N' },	/* undocumented */
 	    { NULL,                 0, 0, '\0'}, 
@@ -251,13 +386,21 @@ main(int argc, char **argv)
 		   " -v --verbose                    Show verbose progress messages\n"
 		   " -q --quiet                      Suppress normal warnings\n"
 		   " -i --incremental=TIME           Incremental dump beginning after specified RFC3339-format TIME.\n"
-		   " -t --threads=N                  Use threaded scheduler with N threads for CVS master analyses.\n"
+		   " -t --threads=N                  Use N threads for CVS master analyses and branch collation.\n"
 		   " -E --embed-id                   Embed CVS revisions in the commit messages.\n"
+		   "    --state=DIR                  Keep incremental state in DIR between runs.\n"
+		   "    --save-forest=FILE           Save the parsed masters as an image in FILE.\n"
+		   "    --load-forest=FILE           Take parsed masters from an image instead of a file list.\n"
+		   "    --spill                      Hold parsed revision trees in a temporary file until export.\n"
+		   "    --stats=FILE                 Write a JSON report of per-phase resource usage to FILE.\n"
+		   "    --profile-masters=FILE       Report the costliest masters, and write all per-master costs to FILE.\n"
+		   "    --trace=FILE                 Write a Chrome trace-event timeline of phases, parses and lock waits to FILE.\n"
 		   "\n"
 		   "Example: find | cvs-fast-export\n");
 	    return 0;
 	case 'g':
 	    exec_mode = ExecuteGraph;
+	    import_options.metadata_only = true;
 	    break;
 	case 'P':
 	    import_options.promiscuous = true;
@@ -288,6 +431,8 @@ main(int argc, char **argv)
 	    break;
 	case 'a':
 	    exec_mode = ExecuteAuthors;
+	    import_options.authorlist = true;
+	    import_options.metadata_only = true;
 	    break;
 	case 'A':
 	    assert(optarg);
@@ -342,6 +487,37 @@ main(int argc, char **argv)
 	case 'N':
 	    noignores = true;
 	    break;
+	case OPT_STATE:
+	    assert(optarg);
+	    import_options.statedir = optarg;
+	    break;
+	case OPT_SAVE_FOREST:
+	    assert(optarg);
+	    import_options.save_forest = optarg;
+	    break;
+	case OPT_LOAD_FOREST:
+	    assert(optarg);
+	    import_options.load_forest = optarg;
+	    break;
+	case OPT_PROFILE_MASTERS:
+	    assert(optarg);
+	    import_options.profile_masters = fopen(optarg, "w");
+	    if (import_options.profile_masters == NULL)
+		fatal_system_error("cannot open %s for master profile write", optarg);
+	    break;
+	case OPT_TRACE:
+	    assert(optarg);
+	    trace_begin(optarg);
+	    break;
+	case OPT_SPILL:
+	    import_options.spill = true;
+	    break;
+	case OPT_STATS:
+	    assert(optarg);
+	    statsfp = fopen(optarg, "w");
+	    if (statsfp == NULL)
+		fatal_error("cannot open %s for statistics write", optarg);
+	    break;
 	default: /* error message already emitted */
 	    announce("try `%s --help' for more information.\n", argv[0]);
 	    return 1;
@@ -364,6 +540,9 @@ main(int argc, char **argv)
 #endif /*  _SC_NPROCESSORS_ONLN */
 #endif
 
+    if (import_options.statedir != NULL && exec_mode == ExecuteExport)
+	state_load_export(import_options.statedir, &export_options);
+
     gather_stats("before parsing");
 
     /* build CVS structures by parsing masters; may read stdin */
@@ -371,31 +550,45 @@ main(int argc, char **argv)
 
     gather_stats("after parsing");
 
-    /* commit set coalescence happens here */
-    forest.git = collate_to_changesets(forest.cvs, 
-				     forest.filecount,
-				     import_options.verbose);
+    /* commit set coalescence happens here; -a collected its authors while parsing */
+    if (exec_mode != ExecuteAuthors) {
+	forest.git = collate_to_changesets(forest.cvs, 
+					 forest.filecount,
+					 import_options.verbose);
 
-    gather_stats("after branch collation");
+	gather_stats("after collation");
+    }
 
     /* report on the DAG */
-    if (forest.git) {
-	switch(exec_mode) {
-	case ExecuteGraph:
+    switch(exec_mode) {
+    case ExecuteAuthors:
+	export_authors(&forest, &export_options);
+	break;
+    case ExecuteGraph:
+	if (forest.git)
 	    dump_rev_graph(forest.git, NULL);
-	    break;
-	case ExecuteAuthors:
-	    export_authors(&forest, &export_options);
-	    break;
-	case ExecuteExport:
+	break;
+    case ExecuteExport:
+	if (forest.git) {
 	    export_commits(&forest, &export_options, &export_stats);
 	    if (export_options.revision_map != NULL)
 		fclose(export_options.revision_map);
-	    break;
+	    if (import_options.statedir != NULL)
+		state_save_export(import_options.statedir, &export_stats);
 	}
+	break;
     }
 
     gather_stats("total");
+    trace_end();
+
+    if (import_options.profile_masters != NULL)
+	profile_masters_report(import_options.profile_masters);
+
+    if (statsfp != NULL) {
+	write_stats(statsfp, &forest, &export_stats);
+	fclose(statsfp);
+    }
 
     if (progress)
     {
@@ -415,6 +608,15 @@ main(int argc, char **argv)
 		export_stats.snapsize / 1000000.0,
 		natoms,
 		(int)(export_stats.export_total_commits / elapsed));
+	memstats_report(STATUS);
+	atom_hash_stats(STATUS);
+	dir_hash_stats(STATUS);
+	revdir_hash_stats(STATUS);
+	tag_hash_stats(STATUS);
+	author_hash_stats(STATUS);
+	author_seen_stats(STATUS);
+	log_store_stats(STATUS);
+	state_hash_stats(STATUS);
     }
 
     if (LOGFILE != stderr) {
@@ -424,7 +626,9 @@ main(int argc, char **argv)
     }
 
     discard_atoms();
+    log_store_free();
     discard_tags();
+    collate_free();
     revdir_free();
     free_author_map();
     return forest.errcount > 0;
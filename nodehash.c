@@ -105,21 +105,47 @@ void hash_branch(nodehash_t *context, cvs_branch *b)
     b->node = node_for_cvs_number(context, b->number);
 }
 
-void clean_hash(nodehash_t *context)
-/* discard the node list */
+void hash_commits(nodehash_t *context, cvs_commit *commits, const serial_t ncommits)
+/* reattach a digested master's commits to its rebuilt nodes */
 {
+    serial_t i;
+    for (i = 0; i < ncommits; i++) {
+	cvs_commit *c = &commits[i];
+	node_t *n = node_for_cvs_number(context, CREF_GET(const cvs_number, c->number));
+	/* as in cvs_master_branch_build(), dead revisions have no commit */
+	if (n->version != NULL && !n->version->dead)
+	    n->commit = c;
+    }
+}
+
+node_t *unhash_nodes(nodehash_t *context)
+/* empty the table, returning its nodes chained through hash_next */
+{
+    node_t *nodes = NULL;
     int i;
     for (i = 0; i < NODE_HASH_SIZE; i++) {
 	node_t *p = context->table[i];
 	context->table[i] = NULL;
 	while (p) {
 	    node_t *q = p->hash_next;
-	    free(p);
+	    p->hash_next = nodes;
+	    nodes = p;
 	    p = q;
 	}
     }
     context->nentries = 0;
     context->head_node = NULL;
+    return nodes;
+}
+
+void free_nodes(node_t *nodes)
+/* discard a node list made by unhash_nodes() */
+{
+    while (nodes) {
+	node_t *q = nodes->hash_next;
+	free(nodes);
+	nodes = q;
+    }
 }
 
 static int compare(const void *a, const void *b)
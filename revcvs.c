@@ -94,7 +94,7 @@ atom_dir(const char* dirname)
     }
 #ifdef THREADS
     if (threads > 1)
-	pthread_mutex_lock(&dir_bucket_mutex);
+	TRACE_LOCK(&dir_bucket_mutex, "dir_bucket_mutex");
 #endif /* THREADS */
     if ((b = *head)) {
 #ifdef THREADS
@@ -103,7 +103,7 @@ atom_dir(const char* dirname)
 #endif /* THREADS */
 	goto collision;
     }
-    b = xmalloc(sizeof(dir_bucket), __func__);
+    b = compact_alloc(sizeof(dir_bucket), __func__);
     b->next = NULL;
     b->dir.name = dirname;
     *head = b;
@@ -119,6 +119,28 @@ atom_dir(const char* dirname)
     return &(b->dir);
 }
 
+void
+dir_hash_stats(FILE *fp)
+/* report how well the directory table is sized */
+{
+    hash_stats	dirs = {.name = "directories", .hashed = true};
+    int		i;
+
+    for (i = 0; i < DIR_BUCKETS; i++) {
+	const dir_bucket *b, *c;
+	size_t length = 0;
+
+	for (b = dir_buckets[i]; b; b = b->next, length++)
+	    for (c = dir_buckets[i]; c != b; c = c->next)
+		if (HASH_VALUE(c->dir.name) == HASH_VALUE(b->dir.name)) {
+		    dirs.collisions++;
+		    break;
+		}
+	hash_stats_chain(&dirs, length);
+    }
+    hash_stats_report(fp, &dirs);
+}
+
 static cvs_commit *
 cvs_master_find_revision(cvs_master *cm, const cvs_number *number)
 /* given a single-file revlist tree, locate the specific version number */
@@ -129,9 +151,9 @@ cvs_master_find_revision(cvs_master *cm, const cvs_number *number)
     for (h = cm->heads; h; h = h->next) {
 	if (h->tail)
 	    continue;
-	for (c = h->commit; c; c = c->parent)
+	for (c = h->commit; c; c = CREF_GET(cvs_commit, c->parent))
 	{
-	     if (cvs_number_compare(c->number, number) == 0)
+	     if (cvs_number_compare(CREF_GET(const cvs_number, c->number), number) == 0)
 		    return c;
 	     if (c->tail)
 		 break;
@@ -147,7 +169,7 @@ build_rev_master(cvs_file *cvs, rev_master *master)
     master->fileop_name = fileop_name(cvs->export_name);
     master->dir = atom_dir(dir_name(master->name));
     master->mode = cvs->mode;
-    master->commits = xcalloc(cvs->nversions, sizeof(cvs_commit), "commit slab alloc");
+    master->commits = compact_alloc(cvs->nversions * sizeof(cvs_commit), "commit slab alloc");
     master->ncommits = 0;
     return master;
 }
@@ -180,22 +202,22 @@ cvs_master_branch_build(cvs_file *cvs, rev_master *master, const cvs_number *bra
 	if (!v)
 	     continue;
 	commit = master->commits + master->ncommits++;
-	commit->dir = master->dir;
+	CREF_SET(commit->dir, master->dir);
 	commit->date = v->date;
-	commit->commitid = v->commitid;
-	commit->author = v->author;
+	CREF_SET(commit->commitid, v->commitid);
+	CREF_SET(commit->author, v->author);
 	commit->tail = commit->tailed = false;
 	commit->refcount = commit->serial = 0;
 	if (patch != NULL)
-	    commit->log = patch->log;
+	    CREF_SET(commit->log, patch->log);
 	 commit->dead = v->dead;
 	/* leave this around so the branch merging stuff can find numbers */
-	commit->master = master;
-	commit->number = v->number;
+	CREF_SET(commit->master, master);
+	CREF_SET(commit->number, v->number);
 	if (!v->dead) {
 	    node->commit = commit;
 	}
-	commit->parent = head;
+	CREF_SET(commit->parent, head);
 	/* commits are already interned, these hashes build up revdir hashes */
 	commit->hash = HASH_VALUE(c);
 	head = commit;
@@ -211,7 +233,7 @@ cvs_master_branch_build(cvs_file *cvs, rev_master *master, const cvs_number *bra
      * align with newer revisions. (The branch is being traversed
      * in reverse order. p = parent, c = child, gc = grandchild.)
      */
-    for (c = head, gc = NULL; (p = c->parent); gc = c, c = p) {
+    for (c = head, gc = NULL; (p = CREF_GET(cvs_commit, c->parent)); gc = c, c = p) {
 	if (time_compare(p->date, c->date) > 0) {
 	    atom_n = NULL;
 	    /*
@@ -233,15 +255,15 @@ cvs_master_branch_build(cvs_file *cvs, rev_master *master, const cvs_number *bra
 	     */
 	    if (gc && time_compare(p->date, gc->date) <= 0) {
 		c->date = p->date;
-		atom_n = c->number;
+		atom_n = CREF_GET(const cvs_number, c->number);
 	    } else {
 		p->date = c->date;
-		atom_n = p->number;
+		atom_n = CREF_GET(const cvs_number, p->number);
 	    }
 	    if (!nowarn) {
 		warn("warning - %s:", cvs->gen.master_name);
-		dump_number_file(LOGFILE, " ", p->number);
-		dump_number_file(LOGFILE, " is newer than", c->number);
+		dump_number_file(LOGFILE, " ", CREF_GET(const cvs_number, p->number));
+		dump_number_file(LOGFILE, " is newer than", CREF_GET(const cvs_number, c->number));
 		if (atom_n) dump_number_file(LOGFILE, ", adjusting", atom_n);
 		fprintf(LOGFILE, "\n");
 	    }
@@ -251,7 +273,7 @@ cvs_master_branch_build(cvs_file *cvs, rev_master *master, const cvs_number *bra
 #if CVSDEBUG
     if (cvs->verbose > 0)
 	debugmsg("\tnew branch, head number = %s\n",
-	     cvs_number_string(head->number, buf, CVS_MAX_REV_LEN));
+	     cvs_number_string(CREF_GET(const cvs_number, head->number), buf, CVS_MAX_REV_LEN));
 #endif /* CVSDEBUG */
 
     /* coverity[leaked_storage] */
@@ -305,12 +327,14 @@ cvs_master_patch_vendor_branch(cvs_master *cm, cvs_file *cvs)
     assert(strcmp(trunk->ref_name, "master") == 0);
     /* walk all the list of branch heads */
     for (vendor = cm->heads; vendor; vendor = vendor->next) {
-	if (vendor->commit && cvs_is_vendor(vendor->commit->number))
+	if (vendor->commit &&
+	    cvs_is_vendor(CREF_GET(const cvs_number, vendor->commit->number)))
 	{
 	    /* found a vendor branch by its numbering scheme (1.1.{odd}.n) */
 #ifdef CVSDEBUG
 	    char	vrev[CVS_MAX_REV_LEN];
-	    cvs_number_string(vendor->commit->number, vrev, sizeof(vrev));
+	    cvs_number_string(CREF_GET(const cvs_number, vendor->commit->number),
+			      vrev, sizeof(vrev));
 	    fprintf(stderr, "Vendor branch ending in %s\n", vrev);
 #endif /* CVSDEBUG */
 
@@ -325,10 +349,12 @@ cvs_master_patch_vendor_branch(cvs_master *cm, cvs_file *cvs)
 		cvs_commit	*vlast;
 
 		/* walk down vendor branch to its initial commit, 1.1.{odd}.1 */
-		for (vlast = vendor->commit; vlast; vlast = vlast->parent)
+		for (vlast = vendor->commit; vlast;
+		     vlast = CREF_GET(cvs_commit, vlast->parent))
 		    if (!vlast->parent)
 			break;
-		memcpy(&branch, vlast->number, sizeof(cvs_number));
+		memcpy(&branch, CREF_GET(const cvs_number, vlast->number),
+		       sizeof(cvs_number));
 		/* reduce 1.1.{odd}.1 to 1.1.{odd}, and synthesize a name from that */
 		branch.c--;
 		cvs_number_string(&branch, rev, sizeof(rev));
@@ -344,21 +370,21 @@ cvs_master_patch_vendor_branch(cvs_master *cm, cvs_file *cvs)
 	     * this should be equivalent, since the branches
 	     * have not yet been grafted.
 	     */
-	    vendor->degree = vendor->commit->number->c;
-	    vendor->number = vendor->commit->number;
+	    vendor->degree = CREF_GET(const cvs_number, vendor->commit->number)->c;
+	    vendor->number = CREF_GET(const cvs_number, vendor->commit->number);
 
 	}
     }
 
     /* if there's a vendor branch and no commit 1.2... */
-    if (nvendor != NULL && trunk->commit->parent == NULL) {
+    if (nvendor != NULL && CREF_GET(cvs_commit, trunk->commit->parent) == NULL) {
 	cvs_commit	*vlast, *oldtip = trunk->commit;
 	trunk->commit = nvendor->commit;
-	trunk->degree = nvendor->commit->number->c;
-	trunk->number = nvendor->commit->number;
-	for (vlast = trunk->commit; vlast; vlast = vlast->parent)
+	trunk->degree = CREF_GET(const cvs_number, nvendor->commit->number)->c;
+	trunk->number = CREF_GET(const cvs_number, nvendor->commit->number);
+	for (vlast = trunk->commit; vlast; vlast = CREF_GET(cvs_commit, vlast->parent))
 	    if (!vlast->parent) {
-		vlast->parent = oldtip;
+		CREF_SET(vlast->parent, oldtip);
 		break;
 	    }
 	for (vendor = cm->heads; vendor; vendor = vendor->next)
@@ -393,7 +419,7 @@ cvs_master_graft_branches(cvs_master *cm, cvs_file *cvs)
 	/*
 	 * Find last commit on branch
 	 */
-	for (c = h->commit; c && c->parent; c = c->parent)
+	for (c = h->commit; c && c->parent; c = CREF_GET(cvs_commit, c->parent))
 	    if (c->tail) {
 		c = NULL;	/* already been done, skip */
 		break;
@@ -407,9 +433,9 @@ cvs_master_graft_branches(cvs_master *cm, cvs_file *cvs)
 	    for (cv = cvs->gen.versions; cv; cv = cv->next) {
 		for (cb = cv->branches; cb; cb = cb->next) {
 		    if (cvs_number_compare(cb->number,
-					    c->number) == 0)
+					   CREF_GET(const cvs_number, c->number)) == 0)
 		    {
-			c->parent = cvs_master_find_revision(cm, cv->number);
+			CREF_SET(c->parent, cvs_master_find_revision(cm, cv->number));
 			c->tail = true;
 			break;
 		    }
@@ -500,7 +526,8 @@ cvs_master_set_refs(cvs_master *cm, cvs_file *cvsfile)
 	 */
 	if (cvs_is_head(s->number)) {
 	    for (h = cm->heads; h; h = h->next) {
-		if (cvs_same_branch(h->commit->number, s->number))
+		if (cvs_same_branch(CREF_GET(const cvs_number, h->commit->number),
+				    s->number))
 		    break;
 	    }
 	    if (h) {
@@ -542,7 +569,7 @@ cvs_master_set_refs(cvs_master *cm, cvs_file *cvsfile)
 
 	if (h->ref_name)
 	    continue;
-	for (c = h->commit; c; c = c->parent) {
+	for (c = h->commit; c; c = CREF_GET(cvs_commit, c->parent)) {
 	    if (!c->dead)
 		break;
 	}
@@ -565,11 +592,12 @@ cvs_master_set_refs(cvs_master *cm, cvs_file *cvsfile)
 	     */
 	    h->number = atom_cvs_number(cvs_zero);
 	    warn("discarding dead untagged branch %s in %s\n",
-		 cvs_number_string(h->commit->number, buf, sizeof(buf)),
+		 cvs_number_string(CREF_GET(const cvs_number, h->commit->number),
+				   buf, sizeof(buf)),
 		 cvsfile->export_name);
 	    continue;
 	}
-	memcpy(&n, c->number, sizeof(cvs_number));
+	memcpy(&n, CREF_GET(const cvs_number, c->number), sizeof(cvs_number));
 	/* convert to branch form */
 	n.n[n.c-1] = n.n[n.c-2];
 	n.n[n.c-2] = 0;
@@ -625,7 +653,7 @@ cvs_master_set_refs(cvs_master *cm, cvs_file *cvsfile)
 	    cvs_number_string(h->number, rev, sizeof(rev));
 	    if (h->commit->commitid)
 		sprintf(name, "%s-UNNAMED-BRANCH-%s", h->parent->ref_name,
-			h->commit->commitid);
+			CREF_GET(const char, h->commit->commitid));
 	    else
 		sprintf(name, "%s-UNNAMED-BRANCH", h->parent->ref_name);
 	    warn("warning - putting %s rev %s on unnamed branch %s off %s\n",
@@ -805,7 +833,7 @@ cvs_master_digest(cvs_file *cvs, cvs_master *cm, rev_master *master)
     char buf[CVS_MAX_REV_LEN];
 #endif /* CVSDEBUG */
 
-    build_branches(&cvs->gen.nodehash);
+    build_branches(&cvs->nodehash);
     /*
      * Locate first revision on trunk branch
      */
@@ -859,7 +887,8 @@ cvs_master_digest(cvs_file *cvs, cvs_master *cm, rev_master *master)
 		debugmsg("\t%s\t->\t%s\t->\t%s\n",
 			 cvs_number_string(cv->number, buf, CVS_MAX_REV_LEN),
 			 cvs_number_string(cb->number, buf2, CVS_MAX_REV_LEN),
-			 cvs_number_string(branch->number, buf3, CVS_MAX_REV_LEN));
+			 cvs_number_string(CREF_GET(const cvs_number, branch->number),
+					   buf3, CVS_MAX_REV_LEN));
 	    }
 #endif /* CVSDEBUG */
 	    rev_list_add_head(cm, branch, NULL, 0);
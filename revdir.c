@@ -12,6 +12,9 @@
 #include "cvs.h"
 #include "hash.h"
 #include "revdir.h"
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
 
 static bool
 dir_is_ancestor(const master_dir *child, const master_dir *ancestor)
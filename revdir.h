@@ -16,6 +16,14 @@ revdir_pack_files(const cvs_commit **files, const size_t nfiles, revdir *revdir)
 serial_t
 revdir_nfiles(const revdir *revdir);
 
+/* fingerprint of a revdir's file list; equal lists have equal fingerprints */
+hash_t
+revdir_hash(const revdir *revdir);
+
+/* do two revdirs hold the same file list in the same order? */
+bool
+revdir_equal(const revdir *a, const revdir *b);
+
 /* Create a revdir a file at a time */
 void
 revdir_pack_alloc(const size_t max_size);
@@ -52,6 +60,10 @@ revdir_iter_next_dir(revdir_iter *it);
 bool
 revdir_iter_same_dir(const revdir_iter *it1, const revdir_iter *it2);
 
+/* report chain-length statistics for the pack table */
+void
+revdir_hash_stats(FILE *fp);
+
 void
 revdir_free_bufs(void);
 
@@ -49,9 +49,10 @@ rev_list_set_tail(head_list *rl)
 	    head->tail = tail;
 	    tail = false;
 	}
-	for (c = head->commit; c; c = c->parent) {
+	for (c = head->commit; c; c = CREF_GET(cvs_commit, c->parent)) {
 	    /* set tail on the child of the first join commit on this branch */
-	    if (tail && c->parent && c->refcount < c->parent->refcount) {
+	    if (tail && c->parent &&
+		c->refcount < CREF_GET(cvs_commit, c->parent)->refcount) {
 		c->tail = true;
 		tail = false;
 	    }
@@ -0,0 +1,947 @@
+/*
+ * Persistent incremental state, so repeated syncs re-parse only changed
+ * masters.
+ *
+ *  SPDX-License-Identifier: GPL-2.0+
+ *
+ * A state directory holds two files:
+ *
+ * masters - for each master, its size, mtime and content hash together
+ *           with a serialized image of what the grammar built from it.
+ *           A master whose size and mtime are unchanged, or whose mtime
+ *           moved but whose content hash did not, is reconstituted from
+ *           this image instead of being lexed and parsed again.  Patch
+ *           text is not cached; like a fresh parse, the image records
+ *           only the offset and length of each text in the master, which
+ *           is why an unchanged master is required.
+ *
+ * export -  the highest mark and the newest commit date shipped by the
+ *           last export.  A later run numbers its marks above the old
+ *           ones, so git fast-import --import-marks/--export-marks can be
+ *           used across runs, and defaults to an incremental dump
+ *           beginning where the last one ended.
+ *
+ * The masters file is in native byte order and structure layout; it is
+ * a cache, not an interchange format.  Its header carries the hash of
+ * a fixed string, so content hashes from a build with a different hash
+ * family, width or seed are never compared.  If the header doesn't
+ * match, the whole cache is silently discarded and every master is
+ * parsed.
+ *
+ * Collation is always redone from scratch over the cached and freshly
+ * parsed results; it is cheap compared to lexing the masters.
+ *
+ * The same serialized images make up a forest image (--save-forest,
+ * --load-forest): one file holding the parse results of every master in
+ * path_deep_compare order, with an offset table so that worker threads
+ * can pick out masters independently.  Loading an image maps it and
+ * skips the file-list read, the stat calls and the parse; the cheap
+ * digest into cvs_master/rev_master/cvs_commit slabs, atoms and tags is
+ * redone from it, so the image holds no pointers and doesn't care where
+ * it is mapped.  Patch text stays in the masters, so exporting from a
+ * loaded image still needs them, but -g and -a do not.
+ *
+ * With --spill the versions and patches of each master are written, in
+ * the same serialized form, to an anonymous temporary file as soon as
+ * the master is digested, and the in-core copies freed, so they take
+ * no memory during collation.  export_commits() reads each back just
+ * before generating its snapshots, rebuilding the node tree and
+ * reattaching it to the master's commits.
+ */
+
+#ifdef USE_MMAP
+#include <sys/mman.h>
+#endif /* USE_MMAP */
+#include <fcntl.h>
+
+#include "cvs.h"
+#include "hash.h"
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
+
+#define STATE_MAGIC	"cvs-fast-export state 2\n"
+#define FOREST_MAGIC	"cvs-fast-export forest 1\n"
+#define STATE_HASH	49157
+
+typedef struct _state_entry {
+    struct _state_entry	*next;
+    const char		*name;		/* an atom, so compare pointers */
+    const char		*export_name;
+    mode_t		mode;
+    off_t		size;
+    struct timespec	mtime;
+    hash_t		hash;
+    unsigned char	*data;		/* serialized parse results */
+    size_t		len;
+} state_entry;
+
+typedef struct _state_buf {
+    unsigned char	*buf;
+    size_t		len, alloc;
+} state_buf;
+
+typedef struct _state_cursor {
+    const unsigned char	*ptr, *end;
+    const char		*name;		/* for error messages */
+} state_cursor;
+
+static const char	*state_dir;
+static state_entry	*state_buckets[STATE_HASH];
+static state_entry	**state_fresh;
+static size_t		state_nfresh;
+static hash_stats	state_stats = {.name = "state cache"};
+
+static struct {
+    const char		*path;
+    unsigned char	*base;
+    size_t		size;
+    uint64_t		nmasters;
+    const unsigned char	*offsets;
+} forest_image;
+
+static struct {
+    FILE		*fp;
+    uint64_t		size;		/* bytes written so far */
+    state_buf		buf;		/* reused by spill_fetch() */
+    struct spill_record {
+	uint64_t		offset, len;
+	const rev_master	*master;	/* NULL if never spilled */
+    } *records;
+} spill;
+#ifdef THREADS
+static pthread_mutex_t spill_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif /* THREADS */
+
+static uint64_t
+state_hash_check(void)
+/* identifies the hash function content hashes were made with */
+{
+    return hash_string(STATE_MAGIC);
+}
+
+static unsigned
+state_hash(const char *name)
+{
+    HASH_INIT(h);
+    HASH_MIX(h, name);
+    return h % STATE_HASH;
+}
+
+static state_entry *
+state_find(const char *name)
+/* find the cached record for a master, if any */
+{
+    state_entry	*e;
+
+    for (e = state_buckets[state_hash(name)]; e; e = e->next)
+	if (e->name == name)
+	    return e;
+    return NULL;
+}
+
+static char *
+state_path(const char *file, char *path, size_t pathlen)
+/* full path of a file in the state directory */
+{
+    (void)snprintf(path, pathlen, "%s/%s", state_dir, file);
+    return path;
+}
+
+static bool
+content_hash(const char *name, hash_t *hash)
+/* hash the content of a master */
+{
+    FILE	*fp;
+    char	buf[BUFSIZ];
+    size_t	n;
+    HASH_INIT(h);
+
+    if ((fp = fopen(name, "r")) == NULL)
+	return false;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+	h = hash_mix(h, buf, n);
+    (void)fclose(fp);
+    *hash = h;
+    return true;
+}
+
+/*
+ * Serialization primitives.
+ */
+
+static void
+put(state_buf *sb, const void *p, size_t n)
+{
+    if (sb->len + n > sb->alloc) {
+	while (sb->len + n > sb->alloc)
+	    sb->alloc = sb->alloc ? sb->alloc * 2 : 1024;
+	sb->buf = xrealloc(sb->buf, sb->alloc, "state serialization");
+    }
+    memcpy(sb->buf + sb->len, p, n);
+    sb->len += n;
+}
+
+#define put_value(sb, v)	put((sb), &(v), sizeof(v))
+
+static void
+put_string(state_buf *sb, const char *s)
+/* NULL is distinguishable from the empty string */
+{
+    uint32_t len = s ? (uint32_t)strlen(s) : UINT32_MAX;
+
+    put_value(sb, len);
+    if (s)
+	put(sb, s, len);
+}
+
+static void
+put_number(state_buf *sb, const cvs_number *n)
+/* NULL is encoded as a negative digit count */
+{
+    short c = n ? n->c : -1;
+
+    put_value(sb, c);
+    if (n)
+	put(sb, n->n, n->c * sizeof(short));
+}
+
+static void
+get(state_cursor *sc, void *p, size_t n)
+{
+    if (sc->ptr + n > sc->end)
+	fatal_error("saved parse results for %s are truncated\n", sc->name);
+    memcpy(p, sc->ptr, n);
+    sc->ptr += n;
+}
+
+#define get_value(sc, v)	get((sc), &(v), sizeof(v))
+
+static const char *
+get_atom(state_cursor *sc)
+{
+    uint32_t	len;
+    char	*s;
+    const char	*a;
+
+    get_value(sc, len);
+    if (len == UINT32_MAX)
+	return NULL;
+    s = xmalloc(len + 1, __func__);
+    get(sc, s, len);
+    s[len] = '\0';
+    a = atom(s);
+    free(s);
+    return a;
+}
+
+static const char *
+get_log(state_cursor *sc)
+/* a log message is stored as text and comes back as a handle */
+{
+    uint32_t	len;
+    char	*s;
+    const char	*log;
+
+    get_value(sc, len);
+    if (len == UINT32_MAX)
+	return NULL;
+    s = xmalloc(len + 1, __func__);
+    get(sc, s, len);
+    s[len] = '\0';
+    log = log_intern(s);
+    free(s);
+    return log;
+}
+
+static const cvs_number *
+get_number(state_cursor *sc)
+{
+    cvs_number	n;
+
+    get_value(sc, n.c);
+    if (n.c < 0)
+	return NULL;
+    if (n.c > CVS_MAX_DEPTH)
+	fatal_error("saved parse results for %s are corrupt\n", sc->name);
+    get(sc, n.n, n.c * sizeof(short));
+    return atom_cvs_number(n);
+}
+
+static void
+serialize_deltas(state_buf *sb, const generator_t *gen)
+/* capture a master's versions and patches */
+{
+    const cvs_version	*v;
+    const cvs_branch	*b;
+    const cvs_patch	*p;
+    uint32_t		count;
+
+    for (count = 0, v = gen->versions; v; v = v->next)
+	count++;
+    put_value(sb, count);
+    for (v = gen->versions; v; v = v->next) {
+	put_number(sb, v->number);
+	put_value(sb, v->date);
+	put_string(sb, v->author);
+	put_string(sb, v->state);
+	put_string(sb, v->commitid);
+	put_number(sb, v->parent);
+	for (count = 0, b = v->branches; b; b = b->next)
+	    count++;
+	put_value(sb, count);
+	for (b = v->branches; b; b = b->next)
+	    put_number(sb, b->number);
+    }
+
+    for (count = 0, p = gen->patches; p; p = p->next)
+	count++;
+    put_value(sb, count);
+    for (p = gen->patches; p; p = p->next) {
+	uint64_t length = p->text.length;
+	int64_t offset = p->text.offset;
+	put_number(sb, p->number);
+	put_string(sb, log_text(p->log));
+	put_value(sb, length);
+	put_value(sb, offset);
+    }
+}
+
+static void
+serialize(state_buf *sb, const cvs_file *cvs)
+/* capture everything the grammar builds from a master */
+{
+    const cvs_symbol	*s;
+    uint32_t		count, expand = cvs->gen.expand;
+
+    put_number(sb, cvs->head);
+    put_number(sb, cvs->branch);
+    put_value(sb, expand);
+    put_value(sb, cvs->skew_vulnerable);
+
+    for (count = 0, s = cvs->symbols; s; s = s->next)
+	count++;
+    put_value(sb, count);
+    for (s = cvs->symbols; s; s = s->next) {
+	put_string(sb, s->symbol_name);
+	put_number(sb, s->number);
+    }
+
+    serialize_deltas(sb, &cvs->gen);
+}
+
+static void
+hash_branches(nodehash_t *nodehash, cvs_branch *b)
+/* the grammar's right recursion hashes the last branch number first */
+{
+    if (b != NULL) {
+	hash_branches(nodehash, b->next);
+	hash_branch(nodehash, b);
+    }
+}
+
+static serial_t
+deserialize_deltas(state_cursor *sc, generator_t *gen, nodehash_t *nodehash)
+/* rebuild a master's versions and patches, returning the version count */
+{
+    cvs_version	**vtail = &gen->versions;
+    cvs_patch	**ptail = &gen->patches;
+    uint32_t	i, j, count, nversions, nbranches;
+
+    get_value(sc, nversions);
+    for (i = 0; i < nversions; i++) {
+	cvs_version *v = xcalloc(1, sizeof(cvs_version), __func__);
+	cvs_branch **btail = &v->branches;
+	v->number = get_number(sc);
+	get_value(sc, v->date);
+	v->author = get_atom(sc);
+	v->state = get_atom(sc);
+	v->dead = !strcmp(v->state, "dead");
+	v->commitid = get_atom(sc);
+	v->parent = get_number(sc);
+	get_value(sc, nbranches);
+	for (j = 0; j < nbranches; j++) {
+	    cvs_branch *b = xcalloc(1, sizeof(cvs_branch), __func__);
+	    b->number = get_number(sc);
+	    *btail = b;
+	    btail = &b->next;
+	}
+	hash_branches(nodehash, v->branches);
+	hash_version(nodehash, v);
+	*vtail = v;
+	vtail = &v->next;
+    }
+
+    get_value(sc, count);
+    for (i = 0; i < count; i++) {
+	cvs_patch *p = xcalloc(1, sizeof(cvs_patch), __func__);
+	uint64_t length;
+	int64_t offset;
+	p->number = get_number(sc);
+	p->log = get_log(sc);
+	get_value(sc, length);
+	get_value(sc, offset);
+	p->text.filename = gen->master_name;
+	p->text.length = length;
+	p->text.offset = offset;
+	hash_patch(nodehash, p);
+	*ptail = p;
+	ptail = &p->next;
+    }
+    return nversions;
+}
+
+static void
+deserialize(state_cursor *sc, cvs_file *cvs)
+/* rebuild the grammar's output from a cached image */
+{
+    cvs_symbol	**stail = &cvs->symbols;
+    uint32_t	i, count, expand;
+
+    cvs->head = get_number(sc);
+    cvs->branch = get_number(sc);
+    get_value(sc, expand);
+    cvs->gen.expand = (enum expand_mode)expand;
+    get_value(sc, cvs->skew_vulnerable);
+
+    get_value(sc, count);
+    for (i = 0; i < count; i++) {
+	cvs_symbol *s = xcalloc(1, sizeof(cvs_symbol), "making symbol");
+	s->symbol_name = get_atom(sc);
+	s->number = get_number(sc);
+	*stail = s;
+	stail = &s->next;
+    }
+
+    cvs->nversions += deserialize_deltas(sc, &cvs->gen, &cvs->nodehash);
+}
+
+/*
+ * Entry points for master analysis.
+ */
+
+void
+state_begin(const char *dir, const size_t nmasters)
+/* load cached parse results, making room for this run's */
+{
+    char	path[PATH_MAX];
+    char	magic[sizeof(STATE_MAGIC) - 1];
+    uint32_t	numbersize;
+    uint64_t	hashcheck;
+    FILE	*fp;
+
+    /* with no directory, just collect parse results for a forest image */
+    state_dir = dir;
+    state_nfresh = nmasters;
+    state_fresh = xcalloc(nmasters, sizeof(state_entry *), __func__);
+    if (dir == NULL)
+	return;
+    if (mkdir(dir, S_IRWXU | S_IRWXG) != 0 && errno != EEXIST)
+	fatal_system_error("state directory %s", dir);
+
+    if ((fp = fopen(state_path("masters", path, sizeof(path)), "r")) == NULL)
+	return;
+    if (fread(magic, sizeof(magic), 1, fp) != 1
+	|| memcmp(magic, STATE_MAGIC, sizeof(magic)) != 0
+	|| fread(&numbersize, sizeof(numbersize), 1, fp) != 1
+	|| numbersize != sizeof(cvs_number)
+	|| fread(&hashcheck, sizeof(hashcheck), 1, fp) != 1
+	|| hashcheck != state_hash_check()) {
+	(void)fclose(fp);
+	return;
+    }
+    for (;;) {
+	state_entry	*e;
+	uint32_t	namelen;
+	int64_t		size, sec, nsec;
+	uint64_t	len;
+	char		name[PATH_MAX];
+	unsigned	h;
+
+	if (fread(&namelen, sizeof(namelen), 1, fp) != 1)
+	    break;
+	if (namelen >= sizeof(name)
+	    || fread(name, namelen, 1, fp) != 1
+	    || fread(&size, sizeof(size), 1, fp) != 1
+	    || fread(&sec, sizeof(sec), 1, fp) != 1
+	    || fread(&nsec, sizeof(nsec), 1, fp) != 1)
+	    fatal_error("%s is truncated; remove it\n", path);
+	name[namelen] = '\0';
+	e = xcalloc(1, sizeof(state_entry), __func__);
+	e->name = atom(name);
+	e->size = size;
+	e->mtime.tv_sec = sec;
+	e->mtime.tv_nsec = nsec;
+	if (fread(&e->hash, sizeof(e->hash), 1, fp) != 1
+	    || fread(&len, sizeof(len), 1, fp) != 1)
+	    fatal_error("%s is truncated; remove it\n", path);
+	e->len = len;
+	e->data = xmalloc(e->len, __func__);
+	if (e->len > 0 && fread(e->data, e->len, 1, fp) != 1)
+	    fatal_error("%s is truncated; remove it\n", path);
+	h = state_hash(e->name);
+	e->next = state_buckets[h];
+	state_buckets[h] = e;
+    }
+    (void)fclose(fp);
+}
+
+bool
+state_fetch(const size_t i, const struct stat *sb, cvs_file *cvs)
+/* reconstitute a master from the cache if it hasn't changed */
+{
+    state_entry	*e = state_find(cvs->gen.master_name);
+    state_cursor sc;
+
+    if (e == NULL || e->size != sb->st_size)
+	goto miss;
+    if (e->mtime.tv_sec != sb->st_mtim.tv_sec
+	|| e->mtime.tv_nsec != sb->st_mtim.tv_nsec) {
+	/* touched, but perhaps by something like a resync that didn't change it */
+	hash_t hash;
+	if (!content_hash(cvs->gen.master_name, &hash) || hash != e->hash)
+	    goto miss;
+	e->mtime = sb->st_mtim;
+    }
+
+    sc.ptr = e->data;
+    sc.end = e->data + e->len;
+    sc.name = cvs->gen.master_name;
+    deserialize(&sc, cvs);
+    e->export_name = cvs->export_name;
+    e->mode = cvs->mode;
+    state_fresh[i] = e;
+    return true;
+
+miss:
+    return false;
+}
+
+void
+state_store(const size_t i, const struct stat *sb, const cvs_file *cvs)
+/* remember a freshly parsed master for the next run */
+{
+    state_entry	*e = xcalloc(1, sizeof(state_entry), __func__);
+    state_buf	buf = {NULL, 0, 0};
+
+    e->name = cvs->gen.master_name;
+    e->export_name = cvs->export_name;
+    e->mode = cvs->mode;
+    if (state_dir != NULL) {
+	e->size = sb->st_size;
+	e->mtime = sb->st_mtim;
+	if (!content_hash(e->name, &e->hash)) {
+	    free(e);
+	    return;
+	}
+    }
+    serialize(&buf, cvs);
+    e->data = buf.buf;
+    e->len = buf.len;
+    state_fresh[i] = e;
+}
+
+void
+state_end(void)
+/* write the cache for the next run and discard this one */
+{
+    char	path[PATH_MAX], tmp[PATH_MAX];
+    uint32_t	numbersize = sizeof(cvs_number);
+    uint64_t	hashcheck = state_hash_check();
+    FILE	*fp;
+    size_t	i;
+    int		h;
+    unsigned	reused = 0, parsed = 0;
+
+    if (state_dir == NULL)
+	goto discard;
+    state_path("masters", path, sizeof(path));
+    state_path("masters.new", tmp, sizeof(tmp));
+    if ((fp = fopen(tmp, "w")) == NULL)
+	fatal_system_error("%s", tmp);
+    fwrite(STATE_MAGIC, sizeof(STATE_MAGIC) - 1, 1, fp);
+    fwrite(&numbersize, sizeof(numbersize), 1, fp);
+    fwrite(&hashcheck, sizeof(hashcheck), 1, fp);
+    for (i = 0; i < state_nfresh; i++) {
+	state_entry *e = state_fresh[i];
+	uint32_t namelen;
+	int64_t size, sec, nsec;
+	uint64_t len;
+
+	if (e == NULL)
+	    continue;
+	namelen = strlen(e->name);
+	size = e->size;
+	sec = e->mtime.tv_sec;
+	nsec = e->mtime.tv_nsec;
+	len = e->len;
+	fwrite(&namelen, sizeof(namelen), 1, fp);
+	fwrite(e->name, namelen, 1, fp);
+	fwrite(&size, sizeof(size), 1, fp);
+	fwrite(&sec, sizeof(sec), 1, fp);
+	fwrite(&nsec, sizeof(nsec), 1, fp);
+	fwrite(&e->hash, sizeof(e->hash), 1, fp);
+	fwrite(&len, sizeof(len), 1, fp);
+	fwrite(e->data, e->len, 1, fp);
+    }
+    if (ferror(fp) || fclose(fp) != 0)
+	fatal_system_error("%s", tmp);
+    if (rename(tmp, path) != 0)
+	fatal_system_error("%s", path);
+
+discard:
+    /* fresh entries that were not loaded from the cache aren't in a bucket */
+    for (i = 0; i < state_nfresh; i++) {
+	state_entry *e = state_fresh[i];
+	if (e == NULL)
+	    continue;
+	else if (state_find(e->name) == e)
+	    ++reused;
+	else {
+	    ++parsed;
+	    free(e->data);
+	    free(e);
+	}
+    }
+    if (progress && state_dir != NULL)
+	announce("state: %u masters reused, %u parsed\n", reused, parsed);
+    free(state_fresh);
+    state_fresh = NULL;
+    for (h = 0; h < STATE_HASH; h++) {
+	state_entry **bucket = &state_buckets[h], *e;
+	size_t length = 0;
+
+	for (e = *bucket; e; e = e->next)
+	    length++;
+	hash_stats_chain(&state_stats, length);
+	while ((e = *bucket)) {
+	    *bucket = e->next;
+	    free(e->data);
+	    free(e);
+	}
+    }
+}
+
+void
+state_hash_stats(FILE *fp)
+/* report how well the cache table was sized, as it stood before state_end() */
+{
+    hash_stats_report(fp, &state_stats);
+}
+
+/*
+ * Forest images.
+ */
+
+void
+forest_image_save(const char *path, const forest_t *forest)
+/* write the parse results collected since state_begin() as an image */
+{
+    uint32_t	numbersize = sizeof(cvs_number);
+    uint8_t	cvsroot = forest->cvsroot;
+    int64_t	textsize = forest->textsize;
+    uint64_t	nmasters = 0, offset;
+    FILE	*fp;
+    size_t	i;
+
+    if ((fp = fopen(path, "w")) == NULL)
+	fatal_system_error("%s", path);
+    for (i = 0; i < state_nfresh; i++)
+	if (state_fresh[i] != NULL)
+	    nmasters++;
+    fwrite(FOREST_MAGIC, sizeof(FOREST_MAGIC) - 1, 1, fp);
+    fwrite(&numbersize, sizeof(numbersize), 1, fp);
+    fwrite(&cvsroot, sizeof(cvsroot), 1, fp);
+    fwrite(&textsize, sizeof(textsize), 1, fp);
+    fwrite(&nmasters, sizeof(nmasters), 1, fp);
+
+    /* offset table, then records */
+    offset = sizeof(FOREST_MAGIC) - 1 + sizeof(numbersize) + sizeof(cvsroot)
+	+ sizeof(textsize) + sizeof(nmasters) + nmasters * sizeof(uint64_t);
+    for (i = 0; i < state_nfresh; i++) {
+	const state_entry *e = state_fresh[i];
+	if (e == NULL)
+	    continue;
+	fwrite(&offset, sizeof(offset), 1, fp);
+	offset += sizeof(uint32_t) + strlen(e->name)
+	    + sizeof(uint32_t) + strlen(e->export_name)
+	    + sizeof(uint32_t) + sizeof(uint64_t) + e->len;
+    }
+    for (i = 0; i < state_nfresh; i++) {
+	const state_entry *e = state_fresh[i];
+	uint32_t namelen, exportlen, mode;
+	uint64_t len;
+
+	if (e == NULL)
+	    continue;
+	namelen = strlen(e->name);
+	exportlen = strlen(e->export_name);
+	mode = e->mode;
+	len = e->len;
+	fwrite(&namelen, sizeof(namelen), 1, fp);
+	fwrite(e->name, namelen, 1, fp);
+	fwrite(&exportlen, sizeof(exportlen), 1, fp);
+	fwrite(e->export_name, exportlen, 1, fp);
+	fwrite(&mode, sizeof(mode), 1, fp);
+	fwrite(&len, sizeof(len), 1, fp);
+	fwrite(e->data, e->len, 1, fp);
+    }
+    if (ferror(fp) || fclose(fp) != 0)
+	fatal_system_error("%s", path);
+}
+
+size_t
+forest_image_open(const char *path, forest_t *forest)
+/* map an image, returning the number of masters in it */
+{
+    state_cursor sc;
+    char	magic[sizeof(FOREST_MAGIC) - 1];
+    uint32_t	numbersize;
+    uint8_t	cvsroot;
+    int64_t	textsize;
+    struct stat	sb;
+    int		fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &sb) != 0)
+	fatal_system_error("%s", path);
+    forest_image.path = path;
+    forest_image.size = sb.st_size;
+#ifdef USE_MMAP
+    forest_image.base = mmap(NULL, forest_image.size,
+			     PROT_READ, MAP_PRIVATE, fd, 0);
+    if (forest_image.base == MAP_FAILED)
+	fatal_system_error("%s", path);
+#else
+    forest_image.base = xmalloc(forest_image.size, __func__);
+    if (read(fd, forest_image.base, forest_image.size) != (ssize_t)forest_image.size)
+	fatal_system_error("%s", path);
+#endif /* USE_MMAP */
+    close(fd);
+
+    sc.ptr = forest_image.base;
+    sc.end = forest_image.base + forest_image.size;
+    sc.name = path;
+    get(&sc, magic, sizeof(magic));
+    get_value(&sc, numbersize);
+    if (memcmp(magic, FOREST_MAGIC, sizeof(magic)) != 0
+	|| numbersize != sizeof(cvs_number))
+	fatal_error("%s is not a forest image from this build\n", path);
+    get_value(&sc, cvsroot);
+    get_value(&sc, textsize);
+    get_value(&sc, forest_image.nmasters);
+    forest_image.offsets = sc.ptr;
+    if (sc.ptr + forest_image.nmasters * sizeof(uint64_t) > sc.end)
+	fatal_error("%s is truncated\n", path);
+
+    forest->cvsroot = cvsroot;
+    forest->textsize = textsize;
+    return forest_image.nmasters;
+}
+
+static void
+forest_image_seek(const size_t i, state_cursor *sc)
+/* point a cursor at the i-th record of the mapped image */
+{
+    uint64_t	offset;
+
+    memcpy(&offset, forest_image.offsets + i * sizeof(offset), sizeof(offset));
+    if (offset >= forest_image.size)
+	fatal_error("%s is truncated\n", forest_image.path);
+    sc->ptr = forest_image.base + offset;
+    sc->end = forest_image.base + forest_image.size;
+    sc->name = forest_image.path;
+}
+
+void
+forest_image_master(const size_t i, const char **name, const char **export_name)
+/* names of the i-th master of the mapped image */
+{
+    state_cursor sc;
+
+    forest_image_seek(i, &sc);
+    *name = get_atom(&sc);
+    *export_name = get_atom(&sc);
+}
+
+void
+forest_image_fetch(const size_t i, cvs_file *cvs)
+/* rebuild the parse results of the i-th master of the mapped image */
+{
+    state_cursor sc;
+    uint32_t	len, mode;
+    uint64_t	datalen;
+
+    forest_image_seek(i, &sc);
+    get_value(&sc, len);
+    sc.ptr += len;
+    get_value(&sc, len);
+    sc.ptr += len;
+    get_value(&sc, mode);
+    get_value(&sc, datalen);
+    if (sc.ptr + datalen > sc.end)
+	fatal_error("%s is truncated\n", forest_image.path);
+    sc.end = sc.ptr + datalen;
+    sc.name = cvs->gen.master_name;
+    cvs->mode = mode;
+    deserialize(&sc, cvs);
+}
+
+void
+forest_image_close(void)
+/* release the mapped image */
+{
+#ifdef USE_MMAP
+    munmap(forest_image.base, forest_image.size);
+#else
+    free(forest_image.base);
+#endif /* USE_MMAP */
+    forest_image.base = NULL;
+}
+
+/*
+ * Spilled generators.
+ */
+
+void
+spill_begin(const size_t nmasters)
+/* open an anonymous file to hold generators between analysis and export */
+{
+    char	path[PATH_MAX];
+    char	*tmp = getenv("TMPDIR");
+    int		fd;
+
+    if (tmp == NULL)
+	tmp = "/tmp";
+    snprintf(path, sizeof(path), "%s/cvs-fast-export-spill-XXXXXX", tmp);
+    if ((fd = mkstemp(path)) == -1 || (spill.fp = fdopen(fd, "w+")) == NULL)
+	fatal_system_error("%s", path);
+    (void)unlink(path);
+    spill.size = 0;
+    spill.records = xcalloc(nmasters, sizeof(struct spill_record), __func__);
+}
+
+void
+spill_store(const size_t i, generator_t *gen, const rev_master *master)
+/* write out a digested master's deltas and free them; thread-safe */
+{
+    struct spill_record *r = &spill.records[i];
+    state_buf	buf = {NULL, 0, 0};
+
+    /* only the append is serialized, not the encoding */
+    serialize_deltas(&buf, gen);
+#ifdef THREADS
+    if (threads > 1)
+	TRACE_LOCK(&spill_mutex, "spill_mutex");
+#endif /* THREADS */
+    if (fwrite(buf.buf, buf.len, 1, spill.fp) != 1)
+	fatal_system_error("generator spill");
+    r->offset = spill.size;
+    r->len = buf.len;
+    r->master = master;
+    spill.size += buf.len;
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_unlock(&spill_mutex);
+#endif /* THREADS */
+    free(buf.buf);
+
+    generator_free(gen);
+    gen->versions = NULL;
+    gen->patches = NULL;
+    gen->head_node = gen->nodes = NULL;
+}
+
+void
+spill_fetch(const size_t i, generator_t *gen)
+/* bring a spilled master's deltas back for snapshot generation */
+{
+    const struct spill_record *r;
+    nodehash_t	nodehash;
+    state_cursor sc;
+
+    if (spill.fp == NULL || (r = &spill.records[i])->master == NULL)
+	return;
+    if (r->len > spill.buf.alloc) {
+	spill.buf.alloc = r->len;
+	spill.buf.buf = xrealloc(spill.buf.buf, spill.buf.alloc, __func__);
+    }
+    if (fseeko(spill.fp, (off_t)r->offset, SEEK_SET) != 0
+	|| fread(spill.buf.buf, r->len, 1, spill.fp) != 1)
+	fatal_system_error("generator spill");
+    sc.ptr = spill.buf.buf;
+    sc.end = spill.buf.buf + r->len;
+    sc.name = gen->master_name;
+
+    /* relink exactly as cvs_master_digest() did */
+    memset(&nodehash, 0, sizeof(nodehash));
+    deserialize_deltas(&sc, gen, &nodehash);
+    build_branches(&nodehash);
+    hash_commits(&nodehash, r->master->commits, r->master->ncommits);
+    gen->head_node = nodehash.head_node;
+    gen->nodes = unhash_nodes(&nodehash);
+}
+
+void
+spill_end(void)
+/* discard the spill file */
+{
+    if (spill.fp == NULL)
+	return;
+    if (progress)
+	announce("spill: %.3fKB of generators held on disk\n", spill.size / 1024.0);
+    (void)fclose(spill.fp);
+    spill.fp = NULL;
+    free(spill.records);
+    spill.records = NULL;
+    free(spill.buf.buf);
+    spill.buf.buf = NULL;
+    spill.buf.len = spill.buf.alloc = 0;
+}
+
+/*
+ * Entry points for export.
+ */
+
+void
+state_load_export(const char *dir, export_options_t *opts)
+/* continue numbering, and by default dumping, where the last export ended */
+{
+    char	path[PATH_MAX];
+    FILE	*fp;
+    unsigned	mark;
+    long	date;
+
+    state_dir = dir;
+    if ((fp = fopen(state_path("export", path, sizeof(path)), "r")) == NULL)
+	return;
+    if (fscanf(fp, "mark %u\ndate %ld\n", &mark, &date) != 2)
+	fatal_error("%s is malformed; remove it\n", path);
+    (void)fclose(fp);
+    opts->basemark = mark;
+    if (opts->fromtime == 0) {
+	opts->fromtime = date;
+	noignores = true;
+    }
+}
+
+void
+state_save_export(const char *dir, const export_stats_t *stats)
+/* record the high-water marks of a completed export */
+{
+    char	path[PATH_MAX], tmp[PATH_MAX];
+    FILE	*fp;
+
+    state_dir = dir;
+    if (mkdir(dir, S_IRWXU | S_IRWXG) != 0 && errno != EEXIST)
+	fatal_system_error("state directory %s", dir);
+    state_path("export", path, sizeof(path));
+    state_path("export.new", tmp, sizeof(tmp));
+    if ((fp = fopen(tmp, "w")) == NULL)
+	fatal_system_error("%s", tmp);
+    fprintf(fp, "mark %u\ndate %ld\n",
+	    (unsigned)stats->last_mark, (long)stats->last_date);
+    if (fclose(fp) != 0 || rename(tmp, path) != 0)
+	fatal_system_error("%s", path);
+}
+
+/* end */
@@ -15,6 +15,7 @@
 #endif /* THREADS */
 
 #include "cvs.h"
+#include "hash.h"
 
 static tag_t *table[4096];
 
@@ -61,7 +62,7 @@ void tag_commit(cvs_commit *c, const char *name, cvs_file *cvsfile)
     tag_t *tag;
 #ifdef THREADS
     if (threads > 1)
-	pthread_mutex_lock(&tag_mutex);
+	TRACE_LOCK(&tag_mutex, "tag_mutex");
 #endif /* THREADS */
     tag = find_tag(name);
     if (tag->last == cvsfile->gen.master_name) {
@@ -104,6 +105,22 @@ cvs_commit **tagged(tag_t *tag)
     return v;
 }
 
+void tag_hash_stats(FILE *fp)
+/* report how well the tag table is sized */
+{
+    hash_stats tags = {.name = "tags"};
+    size_t i;
+
+    for (i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+	size_t length = 0;
+	tag_t *tag;
+	for (tag = table[i]; tag; tag = tag->hash_next)
+	    length++;
+	hash_stats_chain(&tags, length);
+    }
+    hash_stats_report(fp, &tags);
+}
+
 void discard_tags(void)
 /* discard all tag storage */
 {
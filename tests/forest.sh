@@ -0,0 +1,22 @@
+#!/bin/sh
+## Test that a saved forest image reloads to an identical conversion
+image="/tmp/forest-image-$$"
+out="/tmp/forest-out-$$"
+
+trap 'rm -f $image $out.*' EXIT HUP INT QUIT TERM
+
+find t9602.testrepo/module -name '*,v' | sort >$out.list
+cvs-fast-export -T -t 0 --save-forest=$image <$out.list >$out.plain 2>&1
+cvs-fast-export -T -t 0 --load-forest=$image </dev/null >$out.loaded 2>&1
+cvs-fast-export -a -t 0 <$out.list >$out.authors 2>&1
+cvs-fast-export -a -t 0 --load-forest=$image </dev/null >$out.lauthors 2>&1
+
+if cmp -s $out.plain $out.loaded && cmp -s $out.authors $out.lauthors
+then
+    echo "ok - $0"
+else
+    echo "not ok - $0"
+    exit 1
+fi
+
+#end
@@ -0,0 +1,39 @@
+#!/bin/sh
+## Test that masters reloaded from a state directory convert identically
+state="/tmp/statedir-state-$$"
+out="/tmp/statedir-out-$$"
+
+trap 'rm -fr $state $out.*' EXIT HUP INT QUIT TERM
+
+find t9602.testrepo/module -name '*,v' | sort >$out.list
+cvs-fast-export -T -t 0 <$out.list >$out.plain 2>&1
+cvs-fast-export -T -t 0 --state=$state <$out.list >$out.first 2>&1
+# Forget the export high-water marks, keeping only the cached parses
+rm -f $state/export
+cvs-fast-export -T -t 0 --state=$state <$out.list >$out.second 2>&1
+
+# With nothing changed, a rerun continues from the saved mark and date
+# and ships nothing.  -T dates follow mark numbers, so use real ones.
+rm -fr $state
+cvs-fast-export -t 0 --state=$state <$out.list >/dev/null 2>&1
+cp $state/export $out.marks
+cvs-fast-export -t 0 --state=$state <$out.list >$out.rerun 2>/dev/null
+
+# A master that fails to parse is not cached, so it is diagnosed every run
+mkdir $out.bad
+printf 'head\t1.1;\nhead\t1.1;\n' >$out.bad/broken,v
+echo $out.bad/broken,v >$out.badlist
+cvs-fast-export -t 0 --state=$out.bad/state <$out.badlist >/dev/null 2>&1
+cvs-fast-export -t 0 --state=$out.bad/state <$out.badlist 2>$out.diagnosed >/dev/null
+
+if cmp -s $out.plain $out.first && cmp -s $out.plain $out.second && [ -s $state/masters ] \
+	&& cmp -s $out.marks $state/export && ! grep -q '^mark' $out.rerun \
+	&& grep -q 'syntax error' $out.diagnosed
+then
+    echo "ok - $0"
+else
+    echo "not ok - $0"
+    exit 1
+fi
+
+#end
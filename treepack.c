@@ -5,7 +5,6 @@
  *  SPDX-License-Identifier: GPL-2.0+
  */
 
-#define REV_DIR_HASH	786433
 /* Names are getting confusing. Externally we call things a revdir, where really it's
  * just a list of revisions.
  * Internally in treepack, we store as a directory of revisions, which each level having 
@@ -20,55 +19,236 @@ struct _rev_pack {
     cvs_commit **files;
 };
 
-typedef struct _rev_pack_hash {
-    struct _rev_pack_hash *next;
-    rev_pack	          dir;
-} rev_pack_hash;
+/*
+ * Packs are interned in an open-addressed table of pointers.  Lookups
+ * don't take the lock: slots only ever go from empty to full, and a
+ * table that has been outgrown is kept intact until revdir_free(), so
+ * a reader holding an old table sees a consistent, if stale, set.  A
+ * miss is retried under the lock against the current table before a
+ * new pack is added.
+ */
+typedef struct _rev_pack_table {
+    struct _rev_pack_table *older;	/* outgrown, still readable */
+    size_t                 mask;
+    size_t                 count;
+    rev_pack               *slots[];
+} rev_pack_table;
+
+#define PACK_TABLE_MIN	4096
+/* unique packs seen per master on typical repositories */
+#define PACK_TABLE_PER_MASTER	8
+
+static rev_pack_table	*pack_table;
 
-static rev_pack_hash	*buckets[REV_DIR_HASH];
+/* flat directories are packed in runs averaging PACK_CHUNK files */
+#define PACK_CHUNK	64
+#define PACK_CHUNK_MAX	(PACK_CHUNK * 4)
+
+/*
+ * Pack nodes and their dirs/files arrays live for the whole run, so
+ * carve them out of an arena rather than making three mallocs per pack.
+ */
+static arena_t		pack_arena;
+
+#ifdef THREADS
+static pthread_mutex_t	bucket_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* streaming pack state is per thread so branches can collate in parallel */
+#define PACK_LOCAL	__thread
+#define PACK_LOAD(p)		__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define PACK_STORE(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#else
+#define PACK_LOCAL
+#define PACK_LOAD(p)		(p)
+#define PACK_STORE(p, v)	((p) = (v))
+#endif /* THREADS */
 
 typedef struct _pack_frame {
     const master_dir    *dir;
     const rev_pack      **dirs;
     hash_t              hash;
-    unsigned short      ndirs;
-    unsigned short      sdirs;
+    serial_t            ndirs;
+    serial_t            sdirs;
 } pack_frame;
 
 /* variables used by streaming pack interface */
-static serial_t         sfiles = 0;
-static serial_t         nfiles = 0;
-static const cvs_commit **files = NULL;
-static pack_frame       *frame;
-static pack_frame       frames[MAX_DIR_DEPTH];
+static PACK_LOCAL serial_t         sfiles = 0;
+static PACK_LOCAL serial_t         nfiles = 0;
+static PACK_LOCAL const cvs_commit **files = NULL;
+static PACK_LOCAL pack_frame       *frame;
+static PACK_LOCAL pack_frame       frames[MAX_DIR_DEPTH];
+
+static size_t
+pack_slot(hash_t hash)
+/*
+ * The pack hash is a multiplicative mix of aligned pointers, so its low
+ * bits are nearly constant; fold the high bits down before masking.
+ */
+{
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static rev_pack_table *
+pack_table_alloc(size_t size)
+{
+    rev_pack_table *t = xcalloc(1, sizeof(rev_pack_table) + size * sizeof(rev_pack *),
+				"pack table");
+    t->mask = size - 1;
+    return t;
+}
+
+static void
+pack_table_grow(size_t size)
+/* replace the pack table with one of at least size slots; caller holds the lock */
+{
+    rev_pack_table *old = pack_table, *t;
+    size_t i, s = PACK_TABLE_MIN;
+
+    while (s < size)
+	s *= 2;
+    if (old && old->mask + 1 >= s)
+	return;
+    t = pack_table_alloc(s);
+    if (old) {
+	for (i = 0; i <= old->mask; i++) {
+	    rev_pack *r = old->slots[i];
+	    size_t j;
+
+	    if (!r)
+		continue;
+	    for (j = pack_slot(r->hash) & t->mask; t->slots[j]; j = (j + 1) & t->mask)
+		continue;
+	    t->slots[j] = r;
+	}
+	t->count = old->count;
+	t->older = old;
+    }
+    PACK_STORE(pack_table, t);
+}
+
+static const rev_pack *
+rev_pack_find(const rev_pack_table *t, size_t *slot, const hash_t hash,
+	      const rev_pack **dirs, const serial_t ndirs,
+	      const cvs_commit **files, const serial_t nfiles)
+/*
+ * Probe for a pack with the given contents, starting at *slot.  On a
+ * miss, *slot is left at the empty slot that ended the probe.
+ */
+{
+    size_t i = *slot;
+    const rev_pack *r;
+
+    while ((r = PACK_LOAD(t->slots[i]))) {
+	if (r->hash == hash &&
+	    r->nfiles == nfiles && r->ndirs == ndirs &&
+	    !memcmp(dirs, r->dirs, ndirs * sizeof(rev_pack *)) &&
+	    !memcmp(files, r->files, nfiles * sizeof(cvs_commit *)))
+	    return r;
+	i = (i + 1) & t->mask;
+    }
+    *slot = i;
+    return NULL;
+}
+
+static const rev_pack *
+rev_pack_intern(const hash_t hash,
+		const rev_pack **dirs, const serial_t ndirs,
+		const cvs_commit **files, const serial_t nfiles)
+/* return the unique pack with these contents, adding it if it's new */
+{
+    const rev_pack_table *t = PACK_LOAD(pack_table);
+    const rev_pack *found;
+    rev_pack *r;
+    size_t slot = 0;
+
+    /* Avoid packing a file list if we've done it before. */
+    if (t) {
+	slot = pack_slot(hash) & t->mask;
+	if ((found = rev_pack_find(t, &slot, hash, dirs, ndirs, files, nfiles)))
+	    return found;
+    }
+#ifdef THREADS
+    if (threads > 1)
+	TRACE_LOCK(&bucket_mutex, "pack bucket_mutex");
+#endif /* THREADS */
+    /*
+     * Slots are only ever filled, so if the table hasn't been replaced
+     * only the rest of the probe sequence needs another look.
+     */
+    if (t != pack_table) {
+	t = pack_table;
+	if (t)
+	    slot = pack_slot(hash) & t->mask;
+    }
+    if (t && (found = rev_pack_find(t, &slot, hash, dirs, ndirs, files, nfiles))) {
+#ifdef THREADS
+	if (threads > 1)
+	    pthread_mutex_unlock(&bucket_mutex);
+#endif /* THREADS */
+	return found;
+    }
+    if (!t || (t->count + 1) * 2 > t->mask + 1) {
+	pack_table_grow(t ? (t->mask + 1) * 2 : PACK_TABLE_MIN);
+	t = pack_table;
+	slot = pack_slot(hash) & t->mask;
+	while (t->slots[slot])
+	    slot = (slot + 1) & t->mask;
+    }
+    r = arena_alloc(&pack_arena, sizeof(rev_pack), "pack arena");
+    r->hash = hash;
+    r->ndirs = ndirs;
+    r->dirs = arena_alloc(&pack_arena, ndirs * sizeof(rev_pack *), "pack arena");
+    memcpy(r->dirs, dirs, ndirs * sizeof(rev_pack *));
+    r->nfiles = nfiles;
+    r->files = arena_alloc(&pack_arena, nfiles * sizeof(cvs_commit *), "pack arena");
+    memcpy(r->files, files, nfiles * sizeof(cvs_commit *));
+    pack_table->count++;
+    PACK_STORE(pack_table->slots[slot], r);
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_unlock(&bucket_mutex);
+#endif /* THREADS */
+    return r;
+}
+
+static void push_rev_pack(const rev_pack * const r);
 
 static const rev_pack *
 rev_pack_dir(void)
+/*
+ * Pack the directory in the current frame.  A large flat directory is
+ * split into runs of files, each packed as a leaf of its own that
+ * follows the real subdirectories.  Post-order iteration visits the
+ * runs in order, so the file sequence is unchanged, but a commit that
+ * touches one file in the directory only repacks the run holding it;
+ * the others are shared with the parent commit.  Runs end where the
+ * hash of a file's revision pointer hits a fixed pattern, so adding or
+ * removing a file only moves the boundaries around it.
+ */
 {
-    rev_pack_hash **bucket = &buckets[frame->hash % REV_DIR_HASH];
-    rev_pack_hash *h;
-
-    /* avoid packing a file list if we've done it before */ 
-    for (h = *bucket; h; h = h->next) {
-	if (h->dir.hash == frame->hash &&
-	    h->dir.nfiles == nfiles && h->dir.ndirs == frame->ndirs &&
-	    !memcmp(frame->dirs, h->dir.dirs, frame->ndirs * sizeof(rev_pack *)) &&
-	    !memcmp(files, h->dir.files, nfiles * sizeof(cvs_commit *)))
-	{
-	    return &h->dir;
+    serial_t i, start;
+    hash_t chunk;
+
+    if (nfiles <= PACK_CHUNK_MAX)
+	return rev_pack_intern(frame->hash, frame->dirs, frame->ndirs, files, nfiles);
+
+    chunk = hash_init();
+    for (i = start = 0; i < nfiles; i++) {
+	uint64_t p = (uintptr_t)files[i];
+
+	chunk = (chunk ^ (uintptr_t)files[i]) * 16777619U;
+	if (i + 1 == nfiles || i + 1 - start == PACK_CHUNK_MAX ||
+	    (pack_slot((hash_t)(p ^ (p >> 32))) & (PACK_CHUNK - 1)) == 0) {
+	    push_rev_pack(rev_pack_intern(chunk, NULL, 0, files + start, i + 1 - start));
+	    chunk = hash_init();
+	    start = i + 1;
 	}
     }
-    h = xmalloc(sizeof(rev_pack_hash), __func__);
-    h->next = *bucket;
-    *bucket = h;
-    h->dir.hash = frame->hash;
-    h->dir.ndirs = frame->ndirs;
-    h->dir.dirs = xmalloc(frame->ndirs * sizeof(rev_pack *), __func__);
-    memcpy(h->dir.dirs, frame->dirs, frame->ndirs * sizeof(rev_pack *));
-    h->dir.nfiles = nfiles;
-    h->dir.files = xmalloc(nfiles * sizeof(cvs_commit *), __func__);
-    memcpy(h->dir.files, files, nfiles * sizeof(cvs_commit *));
-    return &h->dir;
+    return rev_pack_intern(frame->hash, frame->dirs, frame->ndirs, NULL, 0);
 }
 
 /* Post order tree traversal iterator. */
@@ -82,7 +262,7 @@ struct _revdir_iter {
     cvs_commit     **file;
     cvs_commit     **filemax;
     size_t         dirpos; // current dir is dirstack[dirpos]
-    dir_pos        dirstack[MAX_DIR_DEPTH];
+    dir_pos        dirstack[MAX_DIR_DEPTH + 1]; // runs of a flat dir add a level
 };
 
 bool
@@ -200,6 +380,20 @@ first_subdir (const master_dir *child, const master_dir *ancestor)
 void
 revdir_pack_alloc(const size_t max_size)
 {
+    const rev_pack_table *t = PACK_LOAD(pack_table);
+
+    /* size the shared pack table for the masters about to be packed */
+    if (!t || t->mask + 1 < max_size * PACK_TABLE_PER_MASTER) {
+#ifdef THREADS
+	if (threads > 1)
+	    TRACE_LOCK(&bucket_mutex, "pack bucket_mutex");
+#endif /* THREADS */
+	pack_table_grow(max_size * PACK_TABLE_PER_MASTER);
+#ifdef THREADS
+	if (threads > 1)
+	    pthread_mutex_unlock(&bucket_mutex);
+#endif /* THREADS */
+    }
     if (!files) {
 	files = xmalloc(max_size * sizeof(cvs_commit *), __func__);
 	sfiles = max_size;
@@ -223,7 +417,7 @@ static void
 push_rev_pack(const rev_pack * const r)
 /* Store a revpack in the recursive gathering area */
 {
-    unsigned short *s = &frame->sdirs;
+    serial_t *s = &frame->sdirs;
     if (*s == frame->ndirs) {
 	if (!*s)
 	    *s = 16;
@@ -312,6 +506,19 @@ revdir_nfiles(const revdir *revdir)
     return revpack_nfiles(revdir->revpack);
 }
 
+hash_t
+revdir_hash(const revdir *revdir)
+{
+    return revdir->revpack->hash;
+}
+
+bool
+revdir_equal(const revdir *a, const revdir *b)
+/* packs are interned, so equal file lists share a root pack */
+{
+    return a->revpack == b->revpack;
+}
+
 void
 revdir_pack_files(const cvs_commit **files, const size_t nfiles, revdir *revdir)
 {
@@ -339,27 +546,52 @@ revdir_pack_files(const cvs_commit **files, const size_t nfiles, revdir *revdir)
     revdir_pack_alloc(nfiles);
     revdir_pack_init();
     for (i = 0; i < nfiles; i++)
-	revdir_pack_add(files[i], files[i]->dir);
+	revdir_pack_add(files[i], CREF_GET(const master_dir, files[i]->dir));
 	
     revdir_pack_end(revdir);
     revdir_pack_free();
 }
 
 void
-revdir_free(void)
+revdir_hash_stats(FILE *fp)
+/* open addressing, so chains are the probe sequences from each home slot */
 {
-    size_t i;
-    for (i = 0; i < REV_DIR_HASH; i++) {
-	rev_pack_hash **bucket = &buckets[i];
-	rev_pack_hash *h;
-
-	while ((h = *bucket)) {
-	    *bucket = h->next;
-	    free(h->dir.dirs);
-	    free(h->dir.files);
-	    free(h);
+    hash_stats	packs = {.name = "revdir packs", .hashed = true};
+    const rev_pack_table *t = pack_table;
+    size_t	i, j;
+
+    if (t == NULL)
+	return;
+    packs.buckets = t->mask + 1;
+    for (i = 0; i <= t->mask; i++) {
+	const rev_pack *r = t->slots[i];
+	bool clash = false;
+	size_t probes = 1;
+
+	if (r == NULL)
+	    continue;
+	packs.used++;
+	packs.entries++;
+	for (j = pack_slot(r->hash) & t->mask; j != i; j = (j + 1) & t->mask) {
+	    clash |= t->slots[j]->hash == r->hash;
+	    probes++;
 	}
+	packs.collisions += clash;
+	if (probes > packs.longest)
+	    packs.longest = probes;
+    }
+    hash_stats_report(fp, &packs);
+}
+
+void
+revdir_free(void)
+{
+    while (pack_table) {
+	rev_pack_table *t = pack_table;
+	pack_table = t->older;
+	free(t);
     }
+    arena_free(&pack_arena);
 }
 
 void
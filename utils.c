@@ -2,6 +2,12 @@
 
 #include <stdlib.h>
 #include "cvs.h"
+#ifdef COMPACT_REFS
+#include <sys/mman.h>
+#endif /* COMPACT_REFS */
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
 
 #if defined(__APPLE__)
 #include <mach/mach_time.h>
@@ -20,6 +26,282 @@ int clock_gettime(clockid_t clock_id, struct timespec *tp)
 bool nowarn, noignores;
 unsigned int warncount;
 
+#ifdef MEMSTATS
+/*
+ * Allocation accounting.  Each distinct legend gets a row of counters,
+ * and every live allocation is remembered in an open-addressed table
+ * keyed by address so xfree() and xrealloc() know which row to credit.
+ * The counters are snapshotted at each checkpoint; a phase is the
+ * stretch of the run that ends at its checkpoint.
+ */
+#define MEMSTATS_PHASES		MAX_CHECKPOINTS
+#define MEMSTATS_LEGENDS	1024	/* must be a power of 2 */
+
+typedef struct _memstat {
+    const char	*legend;
+    /* counters for the current phase; live carries across phases */
+    size_t	calls, allocated, live, peak;
+    size_t	phase_calls[MEMSTATS_PHASES];
+    size_t	phase_allocated[MEMSTATS_PHASES];
+    size_t	phase_live[MEMSTATS_PHASES];
+    size_t	phase_peak[MEMSTATS_PHASES];
+} memstat;
+
+typedef struct _memblock {
+    const void	*ptr;
+    size_t	size;
+    memstat	*stat;
+} memblock;
+
+static memstat	memstats[MEMSTATS_LEGENDS];
+static memstat	memstats_total = {.legend = "*"};
+static memstat	memstats_other = {.legend = "(other)"};
+static size_t	memstats_nlegends;
+static const char *memstats_phases[MEMSTATS_PHASES];
+static int	memstats_nphases;
+static memblock	*memblocks;
+static size_t	memblocks_mask, memblocks_count;
+#ifdef THREADS
+static pthread_mutex_t	memstats_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif /* THREADS */
+
+static size_t
+memblock_slot(const void *ptr)
+{
+    uint64_t h = (uintptr_t)ptr;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+static memstat *
+memstats_legend(const char *legend)
+/* find or make the row for a legend; equal strings share a row */
+{
+    uint64_t	h = 14695981039346656037ULL;
+    const char	*cp;
+    size_t	i;
+
+    for (cp = legend; *cp; cp++)
+	h = (h ^ (unsigned char)*cp) * 1099511628211ULL;
+    for (i = h & (MEMSTATS_LEGENDS - 1); memstats[i].legend;
+	 i = (i + 1) & (MEMSTATS_LEGENDS - 1))
+	if (memstats[i].legend == legend || !strcmp(memstats[i].legend, legend))
+	    return &memstats[i];
+    /* keep the table at most three-quarters full */
+    if (memstats_nlegends >= MEMSTATS_LEGENDS / 4 * 3)
+	return &memstats_other;
+    memstats_nlegends++;
+    memstats[i].legend = legend;
+    return &memstats[i];
+}
+
+static void
+memstat_add(memstat *st, size_t size)
+{
+    st->calls++;
+    st->allocated += size;
+    st->live += size;
+    if (st->live > st->peak)
+	st->peak = st->live;
+}
+
+static void
+memblocks_grow(void)
+/* double the address table; it uses the raw allocator so it isn't counted */
+{
+    memblock	*old = memblocks;
+    size_t	i, oldsize = old ? memblocks_mask + 1 : 0;
+    size_t	size = oldsize ? oldsize * 2 : 4096;
+
+    memblocks = calloc(size, sizeof(memblock));
+    if (!memblocks)
+	fatal_system_error("Out of memory, calloc(%zd) failed in allocation accounting",
+			   size * sizeof(memblock));
+    memblocks_mask = size - 1;
+    for (i = 0; i < oldsize; i++)
+	if (old[i].ptr) {
+	    size_t j = memblock_slot(old[i].ptr) & memblocks_mask;
+	    while (memblocks[j].ptr)
+		j = (j + 1) & memblocks_mask;
+	    memblocks[j] = old[i];
+	}
+    (free)(old);
+}
+
+static void
+memstats_charge(const void *ptr, size_t size, char const *legend)
+/* charge an allocation to its legend; a NULL ptr is never freed */
+{
+    memstat *st;
+
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_lock(&memstats_mutex);
+#endif /* THREADS */
+    st = memstats_legend(legend);
+    memstat_add(st, size);
+    memstat_add(&memstats_total, size);
+    if (ptr) {
+	size_t i;
+
+	if ((memblocks_count + 1) * 2 > memblocks_mask + 1 || !memblocks)
+	    memblocks_grow();
+	for (i = memblock_slot(ptr) & memblocks_mask; memblocks[i].ptr;
+	     i = (i + 1) & memblocks_mask)
+	    continue;
+	memblocks[i].ptr = ptr;
+	memblocks[i].size = size;
+	memblocks[i].stat = st;
+	memblocks_count++;
+    }
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_unlock(&memstats_mutex);
+#endif /* THREADS */
+}
+
+static void
+memstats_credit(const void *ptr)
+/* credit a freed allocation back to its legend */
+{
+    size_t	i, j;
+
+    if (!ptr)
+	return;
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_lock(&memstats_mutex);
+#endif /* THREADS */
+    if (memblocks) {
+	for (i = memblock_slot(ptr) & memblocks_mask; memblocks[i].ptr;
+	     i = (i + 1) & memblocks_mask)
+	    if (memblocks[i].ptr == ptr)
+		break;
+	if (memblocks[i].ptr) {
+	    memblocks[i].stat->live -= memblocks[i].size;
+	    memstats_total.live -= memblocks[i].size;
+	    memblocks_count--;
+	    /* backward-shift deletion keeps probe chains unbroken */
+	    for (j = i;;) {
+		size_t k;
+
+		j = (j + 1) & memblocks_mask;
+		if (!memblocks[j].ptr)
+		    break;
+		k = memblock_slot(memblocks[j].ptr) & memblocks_mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+		    continue;
+		memblocks[i] = memblocks[j];
+		i = j;
+	    }
+	    memblocks[i].ptr = NULL;
+	}
+    }
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_unlock(&memstats_mutex);
+#endif /* THREADS */
+}
+
+void xfree(void *ptr)
+{
+    memstats_credit(ptr);
+    (free)(ptr);
+}
+
+static void
+memstat_snapshot(memstat *st, int phase)
+{
+    st->phase_calls[phase] = st->calls;
+    st->phase_allocated[phase] = st->allocated;
+    st->phase_live[phase] = st->live;
+    st->phase_peak[phase] = st->peak;
+    st->calls = st->allocated = 0;
+    st->peak = st->live;
+}
+
+void
+memstats_checkpoint(const char *phase)
+/* close the current accounting phase */
+{
+    size_t	i;
+
+    if (memstats_nphases >= MEMSTATS_PHASES) {
+	announce("ran out of allocation accounting slots %s\n", phase);
+	return;
+    }
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_lock(&memstats_mutex);
+#endif /* THREADS */
+    for (i = 0; i < MEMSTATS_LEGENDS; i++)
+	if (memstats[i].legend)
+	    memstat_snapshot(&memstats[i], memstats_nphases);
+    memstat_snapshot(&memstats_other, memstats_nphases);
+    memstat_snapshot(&memstats_total, memstats_nphases);
+    memstats_phases[memstats_nphases++] = phase;
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_unlock(&memstats_mutex);
+#endif /* THREADS */
+}
+
+static int memstats_sort_phase;
+
+static int
+memstats_compare(const void *a, const void *b)
+/* order rows by peak within the phase being reported, largest first */
+{
+    const memstat *sa = *(const memstat * const *)a;
+    const memstat *sb = *(const memstat * const *)b;
+    size_t pa = sa->phase_peak[memstats_sort_phase];
+    size_t pb = sb->phase_peak[memstats_sort_phase];
+
+    if (pa != pb)
+	return pa < pb ? 1 : -1;
+    return strcmp(sa->legend, sb->legend);
+}
+
+void
+memstats_report(FILE *fp)
+/* dump the per-phase counters as tab-separated lines; "*" is the total */
+{
+    memstat	**rows = xmalloc((MEMSTATS_LEGENDS + 2) * sizeof(memstat *),
+				 "allocation report");
+    size_t	i, nrows;
+    int		phase;
+
+    fprintf(fp, "#phase\tlegend\tcalls\tallocated\tlive\tpeak\n");
+    for (phase = 0; phase < memstats_nphases; phase++) {
+	nrows = 0;
+	rows[nrows++] = &memstats_total;
+	for (i = 0; i < MEMSTATS_LEGENDS; i++)
+	    if (memstats[i].legend)
+		rows[nrows++] = &memstats[i];
+	rows[nrows++] = &memstats_other;
+	memstats_sort_phase = phase;
+	qsort(rows + 1, nrows - 1, sizeof(memstat *), memstats_compare);
+	for (i = 0; i < nrows; i++) {
+	    const memstat *st = rows[i];
+
+	    if (!st->phase_calls[phase] && !st->phase_live[phase])
+		continue;
+	    fprintf(fp, "%s\t%s\t%zu\t%zu\t%zu\t%zu\n",
+		    memstats_phases[phase], st->legend,
+		    st->phase_calls[phase], st->phase_allocated[phase],
+		    st->phase_live[phase], st->phase_peak[phase]);
+	}
+    }
+    free(rows);
+}
+#else
+#define memstats_charge(ptr, size, legend)
+#define memstats_credit(ptr)
+#endif /* MEMSTATS */
+
 
 #if _POSIX_C_SOURCE >= 200112L || _XOPEN_SOURCE >= 600
 void* xmemalign(size_t align, size_t size, char const *legend)
@@ -31,6 +313,7 @@ void* xmemalign(size_t align, size_t size, char const *legend)
     if (err)
 	fatal_error("posix_memalign(%zd, %zd) failed in %s: %s",
 			   align, size, legend, strerror(err));
+    memstats_charge(ret, size, legend);
     return ret;
 }
 #endif
@@ -45,6 +328,7 @@ void* xmalloc(size_t size, char const *legend)
     if (!ret)
 	fatal_system_error("Out of memory, malloc(%zd) failed in %s",
 			   size, legend);
+    memstats_charge(ret, size, legend);
     return ret;
 }
 
@@ -54,12 +338,16 @@ void* xcalloc(size_t nmemb, size_t size, char const *legend)
     if (!ret)
 	fatal_system_error("Out of memory, calloc(%zd, %zd) failed in %s",
 			   nmemb, size, legend);
+    memstats_charge(ret, nmemb * size, legend);
     return ret;
 }
 
 void* xrealloc(void *ptr, size_t size, char const *legend)
 {
-    void *ret = realloc(ptr, size);
+    void *ret;
+
+    memstats_credit(ptr);
+    ret = realloc(ptr, size);
 #ifndef __COVERITY__
     if (!ret && !size)
 	ret = realloc(ptr, 1);
@@ -67,9 +355,110 @@ void* xrealloc(void *ptr, size_t size, char const *legend)
     if (!ret)
 	fatal_system_error("Out of memory, realloc(%zd) failed in %s",
 			   size, legend);
+    memstats_charge(ret, size, legend);
+    return ret;
+}
+
+#ifdef COMPACT_REFS
+/*
+ * The compact heap is one large reservation that pages in as it is
+ * used.  Nothing in it is ever freed; it holds the records that live
+ * for the whole run anyway.  Offset 0 is never handed out, so a zero
+ * reference can stand for NULL.
+ */
+#define COMPACT_HEAP_SIZE	((size_t)UINT32_MAX << COMPACT_SHIFT)
+
+char *compact_base;
+static size_t compact_used = 1 << COMPACT_SHIFT;
+#ifdef THREADS
+static pthread_mutex_t compact_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif /* THREADS */
+
+void* compact_alloc(size_t size, char const *legend)
+{
+    size_t need = (size + (1 << COMPACT_SHIFT) - 1) & ~(((size_t)1 << COMPACT_SHIFT) - 1);
+    void *ret;
+
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_lock(&compact_mutex);
+#endif /* THREADS */
+    if (!compact_base) {
+	compact_base = mmap(NULL, COMPACT_HEAP_SIZE, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (compact_base == MAP_FAILED)
+	    fatal_system_error("Cannot reserve the compact heap in %s", legend);
+    }
+    if (compact_used + need > COMPACT_HEAP_SIZE)
+	fatal_error("compact heap exhausted in %s, rebuild without COMPACT_REFS\n",
+		    legend);
+    ret = compact_base + compact_used;
+    compact_used += need;
+    /* the compact heap is never freed, so it needs no address entry */
+    memstats_charge(NULL, need, legend);
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_unlock(&compact_mutex);
+#endif /* THREADS */
     return ret;
 }
 
+cref_t
+compact_ref(const void *ptr)
+/* turn a pointer into the compact heap into a reference */
+{
+    if (!ptr)
+	return 0;
+    assert((const char *)ptr > compact_base &&
+	   (const char *)ptr < compact_base + COMPACT_HEAP_SIZE &&
+	   !(((const char *)ptr - compact_base) & ((1 << COMPACT_SHIFT) - 1)));
+    return (cref_t)(((const char *)ptr - compact_base) >> COMPACT_SHIFT);
+}
+#endif /* COMPACT_REFS */
+
+typedef struct _arena_block {
+    struct _arena_block *next;
+    size_t              used;
+    size_t              size;
+    char                data[];
+} arena_block;
+
+#define ARENA_BLOCK_SIZE	(1024 * 1024)
+
+void* arena_alloc(arena_t *arena, size_t size, char const *legend)
+/* bump-allocate pointer-aligned, zeroed space that lives until arena_free() */
+{
+    size_t need = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    arena_block *b = arena->blocks;
+
+    if (!b || b->size - b->used < need) {
+	size_t bsize = need > ARENA_BLOCK_SIZE / 4 ? need : ARENA_BLOCK_SIZE;
+
+	b = xcalloc(1, sizeof(arena_block) + bsize, legend);
+	b->size = bsize;
+	/* oversized requests get a block of their own behind the current one */
+	if (bsize != ARENA_BLOCK_SIZE && arena->blocks) {
+	    b->next = arena->blocks->next;
+	    arena->blocks->next = b;
+	} else {
+	    b->next = arena->blocks;
+	    arena->blocks = b;
+	}
+    }
+    b->used += need;
+    return b->data + b->used - need;
+}
+
+void
+arena_free(arena_t *arena)
+{
+    while (arena->blocks) {
+	arena_block *b = arena->blocks;
+	arena->blocks = b->next;
+	free(b);
+    }
+}
+
 char *
 cvstime2rfc3339(const cvstime_t date)
 /* RFC3339 time representation (not thread-safe!) */
@@ -82,6 +471,28 @@ cvstime2rfc3339(const cvstime_t date)
     return timestr;
 }
 
+time_t
+utc_time(const struct tm *tm)
+/* seconds since the epoch of a UTC broken-down time; timegm(3) isn't portable */
+{
+    /* days_from_civil() from Howard Hinnant's calendar algorithms */
+    int64_t year = tm->tm_year + 1900 + tm->tm_mon / 12;
+    int month = tm->tm_mon % 12, era, yoe, doy, doe;
+
+    if (month < 0) {
+	month += 12;
+	year--;
+    }
+    if (month < 2)		/* count years from March */
+	year--;
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = year - era * 400;
+    doy = (153 * ((month + 10) % 12) + 2) / 5 + tm->tm_mday - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return ((int64_t)era * 146097 + doe - 719468) * 86400
+	+ tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+}
+
 /*
  * Print progress messages.
  *
@@ -213,6 +624,126 @@ void progress_interrupt(void)
 #endif /* __UNUSED__ */
 }
 
+/*
+ * Timeline tracing in the Chrome trace-event format, readable by
+ * chrome://tracing and Perfetto.  Events are complete spans written
+ * as they close; the array format tolerates a missing final bracket,
+ * so a run that dies still leaves a usable trace.
+ */
+
+/* lock waits shorter than this many seconds are not worth a span */
+#define TRACE_WAIT_MIN	0.00005
+
+bool tracing;
+static FILE *trace_fp;
+static struct timespec trace_origin, trace_phase_start;
+static int trace_nthreads;
+#ifdef THREADS
+static __thread int trace_tid = -1;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+#else
+static int trace_tid = -1;
+#endif /* THREADS */
+
+static void
+trace_string(const char *s)
+/* write a JSON string literal */
+{
+    fputc('"', trace_fp);
+    for (; *s; s++)
+	if (*s == '"' || *s == '\\')
+	    fprintf(trace_fp, "\\%c", *s);
+	else if ((unsigned char)*s < ' ')
+	    fprintf(trace_fp, "\\u%04x", (unsigned char)*s);
+	else
+	    fputc(*s, trace_fp);
+    fputc('"', trace_fp);
+}
+
+void
+trace_begin(const char *path)
+/* start writing a trace; the calling thread is shown as the main one */
+{
+    trace_fp = fopen(path, "w");
+    if (trace_fp == NULL)
+	fatal_system_error("cannot open %s for trace write", path);
+    clock_gettime(CLOCK_MONOTONIC, &trace_origin);
+    trace_phase_start = trace_origin;
+    trace_tid = trace_nthreads++;
+    fprintf(trace_fp, "[\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"main\"}}",
+	    trace_tid);
+    tracing = true;
+}
+
+void
+trace_end(void)
+{
+    if (!tracing)
+	return;
+    tracing = false;
+    fputs("\n]\n", trace_fp);
+    fclose(trace_fp);
+    trace_fp = NULL;
+}
+
+void
+trace_span(const char *name, const char *category,
+	   const struct timespec *begin, const struct timespec *end)
+/* record a span on the calling thread's track */
+{
+    if (!tracing)
+	return;
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_lock(&trace_mutex);
+#endif /* THREADS */
+    if (trace_tid < 0) {
+	trace_tid = trace_nthreads++;
+	fprintf(trace_fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"worker %d\"}}",
+		trace_tid, trace_tid);
+    }
+    fputs(",\n{\"name\": ", trace_fp);
+    trace_string(name);
+    fprintf(trace_fp, ", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+	    category, trace_tid,
+	    seconds_diff(begin, &trace_origin) * 1e6,
+	    seconds_diff(end, begin) * 1e6);
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_unlock(&trace_mutex);
+#endif /* THREADS */
+}
+
+void
+trace_phase(const char *name)
+/* close the phase that ends here */
+{
+    struct timespec now;
+
+    if (!tracing)
+	return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    trace_span(name, "phase", &trace_phase_start, &now);
+    trace_phase_start = now;
+}
+
+#ifdef THREADS
+void
+trace_mutex_lock(pthread_mutex_t *mutex, const char *name)
+/* take a lock, recording the wait if it was contended for long */
+{
+    struct timespec begin, end;
+
+    if (pthread_mutex_trylock(mutex) == 0)
+	return;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    pthread_mutex_lock(mutex);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (seconds_diff(&end, &begin) >= TRACE_WAIT_MIN)
+	trace_span(name, "lock", &begin, &end);
+}
+#endif /* THREADS */
+
 void fatal_system_error(char const *format,...)
 {
     va_list args;